@@ -0,0 +1,113 @@
+#include "audio.h"
+#include <SDL2/SDL.h>        // SDL2
+#include <math.h>       // pow
+#include <stdio.h>      // printf
+#include <string.h>     // memset
+
+Beeper::Beeper() : toneOn(false), patternPitch(-1){
+  patternBits[0].store(0);
+  patternBits[1].store(0);
+};
+
+Beeper::~Beeper(){
+  shutdown();
+};
+
+bool Beeper::initialize(){
+  if (SDL_InitSubSystem(SDL_INIT_AUDIO) < 0){
+    printf("SDL audio could not initialize! SDL_Error: %s\n", SDL_GetError());
+    return false;
+  }
+  audioStarted = true;
+
+  // Mono 16 bit, in small buffers so the tone starts and stops promptly
+  SDL_AudioSpec want, have;
+  memset(&want, 0, sizeof(want));
+  memset(&have, 0, sizeof(have));
+  want.freq = 44100;
+  want.format = AUDIO_S16SYS;
+  want.channels = 1;
+  want.samples = 512;
+  want.callback = callback;
+  want.userdata = this;
+
+  device = SDL_OpenAudioDevice(NULL, 0, &want, &have, 0);
+  if (device == 0){
+    printf("Could not open audio device! SDL_Error: %s\n", SDL_GetError());
+    shutdown();
+    return false;
+  }
+
+  sampleRate = have.freq > 0 ? have.freq : 44100;
+  halfPeriod = sampleRate / (2 * pitch);
+  if (halfPeriod == 0)
+    halfPeriod = 1;
+  SDL_PauseAudioDevice(device, 0);
+  return true;
+};
+
+void Beeper::setTone(bool on){
+  toneOn.store(on, std::memory_order_relaxed);
+};
+
+void Beeper::setPattern(const unsigned char * pattern, unsigned char note){
+  if (pattern == NULL){
+    patternPitch.store(-1, std::memory_order_relaxed);
+    return;
+  }
+  uint64_t bits[2] = { 0, 0 };
+  for (int i = 0; i < 16; i++)
+    bits[i / 8] = bits[i / 8] << 8 | pattern[i];
+  patternBits[0].store(bits[0], std::memory_order_relaxed);
+  patternBits[1].store(bits[1], std::memory_order_relaxed);
+  patternPitch.store(note, std::memory_order_relaxed);
+};
+
+void Beeper::callback(void * userdata, Uint8 * stream, int length){
+  Beeper & beeper = *(Beeper *)userdata;
+  Sint16 * samples = (Sint16 *)stream;
+  int count = length / sizeof(Sint16);
+
+  // Ramp over ~1.5ms rather than switching straight on or off
+  int target = beeper.toneOn.load(std::memory_order_relaxed) ? volume : 0;
+  const int step = volume / 64;
+
+  // XO-CHIP plays the pattern at 4000 bits a second at pitch 64, an octave
+  // higher for every 48 above that (and lower for every 48 below)
+  int note = beeper.patternPitch.load(std::memory_order_relaxed);
+  uint64_t bits[2] = { beeper.patternBits[0].load(std::memory_order_relaxed),
+    beeper.patternBits[1].load(std::memory_order_relaxed) };
+  uint32_t advance = note < 0 ? 0 : (uint32_t)(4000 *
+    pow(2.0, (note - 64) / 48.0) * 65536 / beeper.sampleRate);
+  const uint32_t patternLength = 128 << 16;
+
+  for (int i = 0; i < count; i++){
+    if (beeper.level < target)
+      beeper.level = beeper.level + step < target ? beeper.level + step : target;
+    else if (beeper.level > target)
+      beeper.level = beeper.level - step > target ? beeper.level - step : target;
+
+    bool high;
+    if (note >= 0){
+      unsigned int bit = beeper.patternPhase >> 16;
+      high = (bits[bit >> 6] >> (63 - (bit & 63))) & 1;
+      beeper.patternPhase = (beeper.patternPhase + advance) % patternLength;
+    } else {
+      high = beeper.phase < beeper.halfPeriod;
+      if (++beeper.phase >= 2 * beeper.halfPeriod)
+        beeper.phase = 0;
+    }
+    samples[i] = high ? beeper.level : -beeper.level;
+  }
+};
+
+void Beeper::shutdown(){
+  // Closing the device waits for any callback in progress to finish
+  if (device != 0)
+    SDL_CloseAudioDevice(device);
+  device = 0;
+
+  if (audioStarted)
+    SDL_QuitSubSystem(SDL_INIT_AUDIO);
+  audioStarted = false;
+};
@@ -0,0 +1,56 @@
+#ifndef AUDIO_H
+#define AUDIO_H
+
+#include "io.h"
+#include <SDL2/SDL.h>      // SDL2
+#include <atomic>
+#include <stdint.h>        // uint32_t, uint64_t
+
+// Plays a square wave while the sound timer runs, or the program's XO-CHIP
+// audio pattern if it has loaded one. SDL calls back for samples on its own
+// audio thread; the core only ever stores atomics, so setTone and setPattern
+// never block or do any I/O. Owns the audio device, closing it when
+// destroyed
+class Beeper : public AudioSink
+{
+private:
+  SDL_AudioDeviceID device = 0;
+  bool audioStarted = false;
+
+  std::atomic<bool> toneOn;
+
+  // the XO-CHIP pattern's 128 bits, and its pitch or -1 if there's none. A
+  // pattern changed halfway through being read is heard for one buffer at
+  // most
+  std::atomic<uint64_t> patternBits[2];
+  std::atomic<int> patternPitch;
+
+  // only touched on the audio thread: samples per half wave, where we are
+  // in the wave, and the current volume, which ramps to avoid clicks
+  unsigned int halfPeriod = 1;
+  unsigned int phase = 0;
+  int level = 0;
+  // and the output rate, and where we are in the pattern (16.16 fixed point)
+  int sampleRate = 44100;
+  uint32_t patternPhase = 0;
+
+  static void callback(void * userdata, Uint8 * stream, int length);
+
+public:
+  static const unsigned int pitch = 440;   // Hz
+  static const int volume = 3000;          // out of 32767
+
+  Beeper();
+  Beeper(const Beeper &) = delete;
+  Beeper & operator=(const Beeper &) = delete;
+  ~Beeper();
+
+  // Opens the default audio device. Prints an error and returns false if
+  // there isn't one, in which case the beeper just stays silent
+  bool initialize();
+  void setTone(bool on);
+  void setPattern(const unsigned char * pattern, unsigned char note);
+  void shutdown();
+};
+
+#endif
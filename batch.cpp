@@ -0,0 +1,282 @@
+#include "chip8.h"
+#include "inputscript.h"
+#include "scheduler.h"
+#include <atomic>
+#include <chrono>
+#include <cstdlib>        // exit, strtod, strtoul, strtoull
+#include <cstring>        // strcmp
+#include <fstream>
+#include <iterator>       // istreambuf_iterator
+#include <map>
+#include <memory>         // unique_ptr
+#include <sstream>
+#include <stdio.h>        // printf
+#include <string>
+#include <thread>
+#include <vector>
+using namespace std;
+
+/* Runs a list of roms, each for a fixed number of cycles, spread across a
+   pool of threads (one Chip8 per thread, reused from rom to rom). Nothing
+   here touches SDL.
+
+   Every rom starts from the same random seed, so results are repeatable.
+   The job list has one rom per line, optionally followed by an input script
+   (see inputscript.h, or "-" for none); without one, no keys are ever
+   pressed. A quirk profile name (see quirks.h) can follow that, for roms
+   written for a particular interpreter. Scripts recorded by main.out
+   --record carry their own seed, hz, profile and length, and the screen the
+   run has to end on. Results are printed as tab separated lines in job
+   order */
+
+struct Job
+{
+  string rom;
+  string script;
+  // from the job list, or else --quirks
+  bool hasQuirks;
+  QuirkProfile quirks;
+  // the rom's contents, shared by every job that runs it (NULL if it
+  // couldn't be read)
+  const vector<unsigned char> * image;
+
+  bool ok;
+  // set if the script is a recording, and whether the run matched it
+  bool checked;
+  bool matched;
+  uint64_t hash;
+  unsigned long long cycles;
+  double ms;
+};
+
+struct Settings
+{
+  double hz;
+  unsigned long long cycles;
+  Engine engine;
+  QuirkProfile quirks;
+  uint64_t seed;
+  bool stats;
+};
+
+void runJob(Chip8 & chip8, const Settings & settings, Job & job){
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  job.ok = false;
+  job.checked = false;
+  job.matched = false;
+  job.hash = 0;
+  job.cycles = 0;
+
+  InputScript script;
+  NullInput noInput;
+  InputSource * input = &noInput;
+  if (!job.script.empty()){
+    if (!script.load(job.script))
+      return;
+    input = &script;
+  }
+
+  if (job.image == NULL)
+    return;
+  chip8.seed(script.hasSeed ? script.seed : settings.seed);
+  chip8.setQuirks(script.hasQuirks ? script.quirks :
+    job.hasQuirks ? job.quirks : settings.quirks);
+  chip8.initialize();
+  if (!chip8.loadGame(job.image->data(), job.image->size())){
+    printf("Skipping rom '%s'\n", job.rom.c_str());
+    return;
+  }
+
+  Scheduler scheduler(script.hz > 0 ? script.hz : settings.hz,
+    script.hasEnd ? script.endCycle : settings.cycles);
+  bool running = true;
+  while (running){
+    script.seek(scheduler.totalCycles);
+    running = scheduler.runFrame(chip8, *input);
+  }
+
+  job.ok = true;
+  job.hash = chip8.screenHash();
+  job.cycles = scheduler.totalCycles;
+  job.checked = script.hasEnd;
+  job.matched = job.checked && job.hash == script.endHash &&
+    job.cycles == script.endCycle;
+  job.ms = chrono::duration<double, milli>(
+    chrono::steady_clock::now() - start).count();
+};
+
+bool readJobs(const char * path, vector<Job> & jobs){
+  ifstream file(path);
+  if (!file.is_open()){
+    printf("Could not open job list '%s'\n", path);
+    return false;
+  }
+
+  string line;
+  while (getline(file, line)){
+    istringstream fields(line);
+    Job job;
+    if (!(fields >> job.rom) || job.rom[0] == '#')
+      continue;
+    fields >> job.script;
+    if (job.script == "-")
+      job.script.clear();
+
+    string quirks;
+    job.hasQuirks = !!(fields >> quirks);
+    if (job.hasQuirks && !quirkProfileFromName(quirks, job.quirks)){
+      printf("Unknown quirk profile '%s' for rom '%s'\n", quirks.c_str(),
+        job.rom.c_str());
+      return false;
+    }
+    jobs.push_back(job);
+  }
+  return true;
+};
+
+// Reads each rom once up front, however many jobs use it
+void readRoms(vector<Job> & jobs, map<string, vector<unsigned char> > & roms){
+  for (size_t j = 0; j < jobs.size(); j++){
+    Job & job = jobs[j];
+    job.image = NULL;
+    if (roms.count(job.rom) == 0){
+      ifstream file(job.rom, ios::in|ios::binary);
+      if (!file.is_open()){
+        printf("Could not open rom '%s'\n", job.rom.c_str());
+        continue;
+      }
+      roms[job.rom].assign(istreambuf_iterator<char>(file),
+        istreambuf_iterator<char>());
+    }
+    job.image = &roms[job.rom];
+  }
+};
+
+void usage(){
+  printf("Usage: ./chip8-batch [options] jobs.txt\n");
+  printf("  jobs.txt has one 'rom/path [input/script|-] [quirks]' per line\n");
+  printf("  --cycles N      instructions to run each rom for (default 1000000)\n");
+  printf("  --threads N     worker threads (default: one per core)\n");
+  printf("  --hz N          instructions per second, which sets how many\n");
+  printf("                  instructions there are per timer tick (default 500)\n");
+  printf("  --engine E      interpreter (default), cached or jit\n");
+  printf("  --seed N        seed for CXNN's random numbers (default 0); the\n");
+  printf("                  same seed and input always give the same result\n");
+  printf("  --quirks Q      quirk profile for roms that don't name one: default,\n");
+  printf("                  vip, chip48, schip or xochip\n");
+  printf("  --stats         count instructions by opcode and address, draws and\n");
+  printf("                  frames across every job, and print the totals to\n");
+  printf("                  stderr (counting always runs on the interpreter)\n");
+  printf("  Recorded scripts override --cycles, --hz, --seed and the quirk\n");
+  printf("  profile, and the replay column says whether the run ended on the\n");
+  printf("  recorded screen\n");
+}
+
+int main(int argc, char **argv)
+{
+  Settings settings;
+  settings.hz = 500;
+  settings.cycles = 1000000;
+  settings.engine = ENGINE_INTERPRETER;
+  settings.quirks = QUIRKS_DEFAULT;
+  settings.seed = 0;
+  settings.stats = false;
+  unsigned int threads = thread::hardware_concurrency();
+  const char * jobList = NULL;
+
+  for (int i = 1; i < argc; i++){
+    if (strcmp(argv[i], "--cycles") == 0 && i + 1 < argc){
+      settings.cycles = strtoull(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc){
+      threads = strtoul(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--hz") == 0 && i + 1 < argc){
+      settings.hz = strtod(argv[++i], NULL);
+    } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc){
+      settings.seed = strtoull(argv[++i], NULL, 0);
+    } else if (strcmp(argv[i], "--stats") == 0){
+      settings.stats = true;
+    } else if (strcmp(argv[i], "--quirks") == 0 && i + 1 < argc){
+      if (!quirkProfileFromName(argv[++i], settings.quirks)){
+        usage();
+        exit(0);
+      }
+    } else if (strcmp(argv[i], "--engine") == 0 && i + 1 < argc){
+      i++;
+      if (strcmp(argv[i], "interpreter") == 0){
+        settings.engine = ENGINE_INTERPRETER;
+      } else if (strcmp(argv[i], "cached") == 0){
+        settings.engine = ENGINE_CACHED;
+      } else if (strcmp(argv[i], "jit") == 0){
+        settings.engine = ENGINE_JIT;
+      } else {
+        usage();
+        exit(0);
+      }
+    } else if (argv[i][0] != '-' && jobList == NULL){
+      jobList = argv[i];
+    } else {
+      usage();
+      exit(0);
+    }
+  }
+
+  if (jobList == NULL || settings.cycles == 0 || settings.hz <= 0){
+    printf("Incorrect arguments. ");
+    usage();
+    exit(0);
+  }
+  if (threads == 0)
+    threads = 1;
+
+  vector<Job> jobs;
+  if (!readJobs(jobList, jobs))
+    exit(1);
+  map<string, vector<unsigned char> > roms;
+  readRoms(jobs, roms);
+
+  // Workers take the next job off the list until there are none left, each
+  // counting into its own stats
+  atomic<size_t> nextJob(0);
+  vector<thread> pool;
+  vector<unique_ptr<Stats> > counts;
+  for (unsigned int t = 0; t < threads && t < jobs.size(); t++){
+    Stats * stats = settings.stats ? new Stats() : NULL;
+    counts.push_back(unique_ptr<Stats>(stats));
+    pool.push_back(thread([&, stats]{
+      unique_ptr<Chip8> chip8(new Chip8());
+      chip8->setEngine(settings.engine);
+      chip8->attachStats(stats);
+      for (size_t j = nextJob++; j < jobs.size(); j = nextJob++)
+        runJob(*chip8, settings, jobs[j]);
+    }));
+  }
+  for (size_t t = 0; t < pool.size(); t++)
+    pool[t].join();
+
+  int failed = 0;
+  printf("rom\tscript\tscreen_hash\tcycles\tms\treplay\n");
+  for (size_t j = 0; j < jobs.size(); j++){
+    const Job & job = jobs[j];
+    if (!job.ok){
+      printf("%s\t%s\terror\t-\t-\t-\n", job.rom.c_str(),
+        job.script.empty() ? "-" : job.script.c_str());
+      failed++;
+      continue;
+    }
+    if (job.checked && !job.matched)
+      failed++;
+    printf("%s\t%s\t%016llx\t%llu\t%.3f\t%s\n", job.rom.c_str(),
+      job.script.empty() ? "-" : job.script.c_str(),
+      (unsigned long long)job.hash, job.cycles, job.ms,
+      !job.checked ? "-" : job.matched ? "match" : "MISMATCH");
+  }
+
+  if (settings.stats){
+    Stats total;
+    for (size_t t = 0; t < counts.size(); t++)
+      total.add(*counts[t]);
+    total.report(stderr);
+  }
+
+  return failed == 0 ? 0 : 1;
+}
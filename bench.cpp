@@ -0,0 +1,438 @@
+#include "chip8.h"
+#include "jit.h"
+#include "pixels.h"
+#include "scheduler.h"
+#include <chrono>
+#include <cstdlib>        // exit, strtod
+#include <cstring>        // strcmp, strstr
+#include <memory>         // unique_ptr
+#include <stdio.h>        // printf, fprintf
+#include <string>
+#include <vector>
+using namespace std;
+
+/* Benchmarks for the core, written out as JSON so runs can be compared from
+   build to build. Nothing here touches SDL.
+
+   Every rom is synthetic and built below, so the numbers don't depend on
+   what's lying around on disk:
+
+   - opcode    one family of instructions repeated through the program area,
+               then a jump back to the start, run on each engine
+   - draw      DXYN with different sprite sizes and positions, including ones
+               that wrap around the edges and high-res mode
+   - pixels    converting whole frames to ARGB, as the Gpu does
+   - load      loadGame from a buffer, for the largest chip8 and XO-CHIP roms
+   - rom       small programs shaped like real ones (drawing, timers, maths),
+               run frame by frame through the Scheduler as fast as possible.
+               rom/idle-wait spends most of its time waiting on the delay
+               timer, which the core skips rather than runs, so it counts
+               cycles gone through rather than instructions run
+
+   Each benchmark is repeated with more and more iterations until a run takes
+   at least --min-time seconds, and the rate of the last run is reported.
+
+   The JIT translates every instruction of some of the opcode benchmarks, and
+   if it's any slower than the cached engine on one of those the run fails */
+
+struct Result
+{
+  string name;
+  string engine;            // empty if it doesn't depend on the engine
+  const char * unit;        // what's being counted
+  unsigned long long count;
+  double seconds;
+};
+
+struct Bench
+{
+  double minTime;
+  const char * filter;
+  vector<Result> results;
+
+  bool wanted(const string & name) const {
+    return filter == NULL || strstr(name.c_str(), filter) != NULL;
+  }
+
+  // Runs work(n) with n doubling until it takes minTime, and records the
+  // last run. work returns how many units it actually did
+  template <class Work>
+  void measure(const string & name, const string & engine, const char * unit,
+      Work work){
+    unsigned long long n = 1000;
+    for (;;){
+      chrono::steady_clock::time_point start = chrono::steady_clock::now();
+      unsigned long long done = work(n);
+      double seconds = chrono::duration<double>(
+        chrono::steady_clock::now() - start).count();
+      if (seconds >= minTime || n >= (1ULL << 40)){
+        Result result = { name, engine, unit, done, seconds };
+        results.push_back(result);
+        printf("%-24s %-12s %12.1f %s/s\n", name.c_str(), engine.c_str(),
+          done / seconds, unit);
+        return;
+      }
+      n *= 2;
+    }
+  }
+};
+
+static const char * const engineNames[] = { "interpreter", "cached", "jit" };
+static const Engine engines[] = { ENGINE_INTERPRETER, ENGINE_CACHED,
+  ENGINE_JIT };
+
+static vector<unsigned char> program(const vector<unsigned short> & code){
+  vector<unsigned char> rom;
+  for (size_t i = 0; i < code.size(); i++){
+    rom.push_back(code[i] >> 8);
+    rom.push_back(code[i] & 0xFF);
+  }
+  return rom;
+}
+
+// A rom made of setup instructions followed by body repeated until the
+// program area is nearly full, then a jump back to the first repeat. The top
+// 256 bytes are left free for the program's data
+static vector<unsigned char> repeatRom(const vector<unsigned short> & setup,
+    const vector<unsigned short> & body){
+  vector<unsigned short> code(setup);
+  unsigned short loop = 0x200 + 2 * setup.size();
+  while (0x200 + 2 * (code.size() + body.size() + 1) <= 0xF00)
+    code.insert(code.end(), body.begin(), body.end());
+  code.push_back(0x1000 | loop);
+  return program(code);
+}
+
+// Runs a rom straight through Chip8::run in batches, counting instructions
+static void runRom(Bench & bench, const string & name,
+    const vector<unsigned char> & rom, unsigned int batch = 10000){
+  for (int e = 0; e < 3; e++){
+    if (!bench.wanted(name))
+      continue;
+    unique_ptr<Chip8> chip8(new Chip8());
+    chip8->setEngine(engines[e]);
+    chip8->initialize();
+    chip8->loadGame(rom.data(), rom.size());
+    bench.measure(name, engineNames[e], "instructions",
+      [&](unsigned long long n){
+        unsigned long long done = 0;
+        while (done < n){
+          unsigned int ran = chip8->run(batch);
+          if (ran == 0)
+            break;
+          done += ran;
+        }
+        return done;
+      });
+  }
+}
+
+static void opcodeBenchmarks(Bench & bench){
+  struct Family
+  {
+    const char * name;
+    vector<unsigned short> setup;
+    vector<unsigned short> body;
+  };
+  const Family families[] = {
+    // 6XNN, 7XNN
+    { "opcode/load", {}, { 0x6012, 0x6134, 0x6256, 0x6378 } },
+    { "opcode/add", {}, { 0x7001, 0x7102, 0x7203, 0x7304 } },
+    // 8XY0 to 8XYE
+    { "opcode/alu", { 0x6133, 0x6255 }, { 0x8010, 0x8121, 0x8232, 0x8343,
+      0x8454, 0x8565, 0x8676, 0x8787, 0x898E } },
+    // 3XNN/4XNN/5XY0/9XY0, taken and not, and EX9E/EXA1 with no keys held
+    { "opcode/skip", {}, { 0x3001, 0x4001, 0x6000, 0x5010, 0x6000, 0x9010,
+      0xE09E, 0xE0A1, 0x6000 } },
+    // ANNN, FX1E, FX29
+    { "opcode/index", {}, { 0xA300, 0xF01E, 0xF129, 0xF21E } },
+    // FX33, FX55, FX65 on data past the code
+    { "opcode/memory", { 0xAF80 }, { 0xF333, 0xF355, 0xF365 } },
+    // CXNN
+    { "opcode/random", {}, { 0xC0FF, 0xC10F } },
+    // FX07, FX15, FX18
+    { "opcode/timers", {}, { 0xF015, 0xF007, 0xF118, 0xF107 } },
+  };
+  for (size_t f = 0; f < sizeof(families) / sizeof(families[0]); f++)
+    runRom(bench, families[f].name,
+      repeatRom(families[f].setup, families[f].body));
+
+  // A short loop of 8XYN in 8 instruction batches, about a frame at the
+  // default 500Hz, so blocks are mostly left and resumed part way through
+  const Family & alu = families[2];
+  vector<unsigned short> loop(alu.setup);
+  for (int i = 0; i < 4; i++)
+    loop.insert(loop.end(), alu.body.begin(), alu.body.end());
+  loop.push_back(0x1000 | (0x200 + 2 * alu.setup.size()));
+  runRom(bench, "opcode/alu-500hz", program(loop), 8);
+
+  // 1NNN and 2NNN/00EE need their targets worked out per address
+  vector<unsigned short> jumps;
+  for (unsigned short a = 0x200; a < 0xEFE; a += 2)
+    jumps.push_back(0x1000 | (a + 2));
+  jumps.push_back(0x1200);
+  runRom(bench, "opcode/jump", program(jumps));
+
+  vector<unsigned short> calls;
+  for (unsigned short a = 0x200; a < 0xEFC; a += 2)
+    calls.push_back(0x2EFE);
+  calls.push_back(0x1200);
+  calls.push_back(0x00EE);
+  runRom(bench, "opcode/call", program(calls));
+}
+
+static void drawBenchmarks(Bench & bench){
+  struct Draw
+  {
+    const char * name;
+    unsigned char x, y, height;
+    bool hires;
+  };
+  const Draw draws[] = {
+    { "draw/1-row", 0, 0, 1, false },
+    { "draw/5-row", 3, 2, 5, false },
+    { "draw/15-row", 3, 2, 15, false },
+    { "draw/16x16", 3, 2, 0, false },
+    { "draw/wrap", 60, 30, 5, false },
+    { "draw/hires", 3, 2, 5, true },
+    { "draw/hires-wrap", 124, 62, 5, true },
+    { "draw/hires-16x16", 120, 56, 0, true },
+  };
+  for (size_t d = 0; d < sizeof(draws) / sizeof(draws[0]); d++){
+    vector<unsigned short> setup;
+    if (draws[d].hires)
+      setup.push_back(0x00FF);
+    setup.push_back(0x6A00 | draws[d].x);
+    setup.push_back(0x6B00 | draws[d].y);
+    setup.push_back(0xA000);   // the font, which is all sprites can reach
+    runRom(bench, draws[d].name,
+      repeatRom(setup, { (unsigned short)(0xDAB0 | draws[d].height) }));
+  }
+}
+
+static void pixelBenchmarks(Bench & bench){
+  // A checkerboard-ish frame with both planes in use
+  uint64_t planes[2][128];
+  for (int i = 0; i < 128; i++){
+    planes[0][i] = 0xAAAA5555AAAA5555ULL >> (i % 7);
+    planes[1][i] = 0x0F0F0F0F0F0F0F0FULL << (i % 5);
+  }
+  const uint64_t * rows[2] = { planes[0], planes[1] };
+  vector<uint32_t> pixels(128 * 64);
+
+  const unsigned int sizes[][2] = { { 64, 32 }, { 128, 64 } };
+  const char * const names[] = { "pixels/lores-frame", "pixels/hires-frame" };
+  for (int s = 0; s < 2; s++){
+    if (!bench.wanted(names[s]))
+      continue;
+    unsigned int width = sizes[s][0];
+    unsigned int height = sizes[s][1];
+    bench.measure(names[s], "", "frames", [&](unsigned long long n){
+      for (unsigned long long i = 0; i < n; i++){
+        framePixels(rows, width, 0, height - 1, pixels.data(), width * 4);
+        // Stop the conversion being optimized away
+        planes[0][i % 128] ^= pixels[i % pixels.size()];
+      }
+      return n;
+    });
+  }
+}
+
+static void loadBenchmarks(Bench & bench){
+  const size_t sizes[] = { 4096 - 0x200, Chip8::maxRomSize };
+  const char * const names[] = { "load/4k", "load/64k" };
+  // XO-CHIP, which is the only profile roms that big can be loaded for
+  unique_ptr<Chip8> chip8(new Chip8());
+  chip8->setQuirks(QUIRKS_XOCHIP);
+  chip8->initialize();
+  for (int s = 0; s < 2; s++){
+    if (!bench.wanted(names[s]))
+      continue;
+    vector<unsigned char> rom(sizes[s]);
+    for (size_t i = 0; i < rom.size(); i++)
+      rom[i] = i * 7 + (i >> 8);
+    bench.measure(names[s], "", "loads", [&](unsigned long long n){
+      for (unsigned long long i = 0; i < n; i++)
+        chip8->loadGame(rom.data(), rom.size());
+      return n;
+    });
+  }
+}
+
+// Runs a rom 60 frames at a time through the Scheduler, as main.out
+// --unthrottled does, counting cycles. Those are instructions run, unless
+// the rom waits on the delay timer and cycles are skipped
+static void frameRom(Bench & bench, const string & name,
+    const vector<unsigned char> & rom, const char * unit = "instructions"){
+  const double hz = 1000000;
+  for (int e = 0; e < 3; e++){
+    if (!bench.wanted(name))
+      continue;
+    unique_ptr<Chip8> chip8(new Chip8());
+    chip8->setEngine(engines[e]);
+    chip8->initialize();
+    chip8->loadGame(rom.data(), rom.size());
+    NullInput input;
+    Scheduler scheduler(hz, 0);
+    bench.measure(name, engineNames[e], unit,
+      [&](unsigned long long n){
+        unsigned long long start = scheduler.totalCycles;
+        while (scheduler.totalCycles - start < n){
+          if (!scheduler.runFrame(*chip8, input))
+            break;
+          chip8->getFrame();
+        }
+        return scheduler.totalCycles - start;
+      });
+  }
+}
+
+static void romBenchmarks(Bench & bench){
+  // A sprite wandering round the screen, with a subroutine call and the
+  // occasional clear
+  vector<unsigned short> game = {
+    0x6A10,  // 200: VA = 16
+    0x6B08,  // 202: VB = 8
+    0x6C00,  // 204: VC = 0
+    0xA240,  // 206: I = sprite
+    0xDAB8,  // 208: loop: erase
+    0xC003,  // 20A: V0 = random & 3
+    0x8A04,  // 20C: VA += V0
+    0xC103,  // 20E: V1 = random & 3
+    0x8B14,  // 210: VB += V1
+    0xDAB8,  // 212: draw
+    0xE09E,  // 214: skip if key V0 held
+    0x7C01,  // 216: VC += 1
+    0x222A,  // 218: call sub
+    0x3C00,  // 21A: skip if VC == 0
+    0x1208,  // 21C: jump loop
+    0x00E0,  // 21E: clear
+    0x1208,  // 220: jump loop
+    0x0000, 0x0000, 0x0000, 0x0000,
+    0x8230,  // 22A: sub: V2 = V3
+    0x7201,  // 22C: V2 += 1
+    0x8324,  // 22E: V3 += V2
+    0x00EE,  // 230: return
+    0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+    0x3C42, 0x8181, 0x8181, 0x423C  // 240: sprite
+  };
+  frameRom(bench, "rom/game", program(game));
+
+  // Counting with a bit of everything from the 8XYN family
+  vector<unsigned short> maths = {
+    0x6000,  // 200: V0 = 0
+    0x6100,  // 202: V1 = 0
+    0x7001,  // 204: loop: V0 += 1
+    0x8104,  // 206: V1 += V0
+    0x8203,  // 208: V2 ^= V0
+    0x8236,  // 20A: V2 >>= 1
+    0x4000,  // 20C: skip if V0 != 0
+    0x7301,  // 20E: V3 += 1
+    0x1204   // 210: jump loop
+  };
+  frameRom(bench, "rom/maths", program(maths));
+
+  // Waits on the delay timer between draws, like most games' main loops.
+  // Nearly all of its cycles are skipped by the wait loop shortcut
+  // (Chip8::skipWait), so its rate is of idle cycles, not instructions
+  vector<unsigned short> waits = {
+    0x6102,  // 200: V1 = 2
+    0xF115,  // 202: delay = V1
+    0xF007,  // 204: wait: V0 = delay
+    0x3000,  // 206: skip if V0 == 0
+    0x1204,  // 208: jump wait
+    0xA000,  // 20A: I = font 0
+    0xD015,  // 20C: draw
+    0x1200   // 20E: start again
+  };
+  frameRom(bench, "rom/idle-wait", program(waits), "cycles");
+}
+
+// Benchmarks that the JIT translates every instruction of
+static const char * const translated[] = { "opcode/load", "opcode/add",
+  "opcode/alu", "opcode/alu-500hz", "opcode/index", "opcode/timers",
+  "opcode/jump" };
+
+// False if the JIT is slower than the cached engine on any of them
+static bool checkJit(const Bench & bench){
+  bool ok = true;
+  for (size_t t = 0; t < sizeof(translated) / sizeof(translated[0]); t++){
+    double rates[2] = { 0, 0 };
+    for (size_t i = 0; i < bench.results.size(); i++){
+      const Result & r = bench.results[i];
+      if (r.name == translated[t] && (r.engine == "cached" || r.engine == "jit"))
+        rates[r.engine == "jit"] = r.count / r.seconds;
+    }
+    if (rates[0] > 0 && rates[1] > 0 && rates[1] < rates[0]){
+      printf("The JIT is slower than the cached engine on %s\n", translated[t]);
+      ok = false;
+    }
+  }
+  return ok;
+}
+
+static bool writeJson(const Bench & bench, const char * path){
+  FILE * file = fopen(path, "w");
+  if (file == NULL){
+    printf("Could not write results to '%s'\n", path);
+    return false;
+  }
+
+  fprintf(file, "{\n  \"min_time\": %g,\n  \"results\": [\n", bench.minTime);
+  for (size_t i = 0; i < bench.results.size(); i++){
+    const Result & r = bench.results[i];
+    fprintf(file, "    {\"name\": \"%s\", \"engine\": \"%s\", \"unit\": \"%s\", "
+      "\"count\": %llu, \"seconds\": %.6f, \"per_second\": %.1f, "
+      "\"ns_each\": %.3f}%s\n", r.name.c_str(), r.engine.c_str(), r.unit,
+      r.count, r.seconds, r.count / r.seconds, r.seconds * 1e9 / r.count,
+      i + 1 < bench.results.size() ? "," : "");
+  }
+  fprintf(file, "  ]\n}\n");
+
+  bool ok = fclose(file) == 0;
+  if (!ok)
+    printf("Could not write results to '%s'\n", path);
+  return ok;
+}
+
+void usage(){
+  printf("Usage: ./chip8-bench [options]\n");
+  printf("  --out F         write the results to F as JSON\n");
+  printf("  --min-time S    seconds each benchmark runs for, at least\n");
+  printf("                  (default 0.2)\n");
+  printf("  --filter S      only run benchmarks with S in their name\n");
+}
+
+int main(int argc, char **argv)
+{
+  Bench bench;
+  bench.minTime = 0.2;
+  bench.filter = NULL;
+  const char * out = NULL;
+
+  for (int i = 1; i < argc; i++){
+    if (strcmp(argv[i], "--out") == 0 && i + 1 < argc){
+      out = argv[++i];
+    } else if (strcmp(argv[i], "--min-time") == 0 && i + 1 < argc){
+      bench.minTime = strtod(argv[++i], NULL);
+    } else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc){
+      bench.filter = argv[++i];
+    } else {
+      usage();
+      exit(0);
+    }
+  }
+
+  opcodeBenchmarks(bench);
+  drawBenchmarks(bench);
+  pixelBenchmarks(bench);
+  loadBenchmarks(bench);
+  romBenchmarks(bench);
+
+  if (out != NULL && !writeJson(bench, out))
+    return 1;
+  // Where there's no JIT, its results are the cached engine's again
+  if (Jit().available() && !checkJit(bench))
+    return 1;
+  return 0;
+}
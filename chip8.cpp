@@ -1,17 +1,14 @@
 #include "chip8.h"
-#include "gpu.h"
-#include <algorithm>    // fill
-#include <cassert>      // assert
+#include "jit.h"
+#include "profiler.h"
+#include <algorithm>    // copy, fill
 #include <fstream>
 #include <iostream>     // cout
-#include <SDL2/SDL.h>   // SDL2
 #include <stdio.h>      // printf, NULL
-#include <stdlib.h>     // srand, rand
 #include <string>
-#include <time.h>       // time
 using namespace std;
 
-unsigned char chip8Fontset[80] =
+static const unsigned char chip8Fontset[80] =
 { 
   0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
   0x20, 0x60, 0x20, 0x20, 0x70, // 1
@@ -31,66 +28,185 @@ unsigned char chip8Fontset[80] =
   0xF0, 0x80, 0xF0, 0x80, 0x80  // F
 };
 
-void Chip8::initialize()
+// SUPER-CHIP's 8x10 font for high-res mode, loaded at bigFontAddress
+static const unsigned short bigFontAddress = 0x50;
+static const unsigned char bigFontset[160] =
 {
-  // Initialize random seed
-  srand(time(NULL));
+  0x3C, 0x7E, 0xE7, 0xC3, 0xC3, 0xC3, 0xC3, 0xE7, 0x7E, 0x3C, // 0
+  0x18, 0x38, 0x58, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x3C, // 1
+  0x3E, 0x7F, 0xC3, 0x06, 0x0C, 0x18, 0x30, 0x60, 0xFF, 0xFF, // 2
+  0x3C, 0x7E, 0xC3, 0x03, 0x0E, 0x0E, 0x03, 0xC3, 0x7E, 0x3C, // 3
+  0x06, 0x0E, 0x1E, 0x36, 0x66, 0xC6, 0xFF, 0xFF, 0x06, 0x06, // 4
+  0xFF, 0xFF, 0xC0, 0xC0, 0xFC, 0xFE, 0x03, 0xC3, 0x7E, 0x3C, // 5
+  0x3E, 0x7C, 0xC0, 0xC0, 0xFC, 0xFE, 0xC3, 0xC3, 0x7E, 0x3C, // 6
+  0xFF, 0xFF, 0x03, 0x06, 0x0C, 0x18, 0x30, 0x60, 0x60, 0x60, // 7
+  0x3C, 0x7E, 0xC3, 0xC3, 0x7E, 0x7E, 0xC3, 0xC3, 0x7E, 0x3C, // 8
+  0x3C, 0x7E, 0xC3, 0xC3, 0x7F, 0x3F, 0x03, 0x03, 0x3E, 0x7C, // 9
+  0x18, 0x3C, 0x66, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3, // A
+  0xFC, 0xFE, 0xC3, 0xC3, 0xFE, 0xFE, 0xC3, 0xC3, 0xFE, 0xFC, // B
+  0x3C, 0x7E, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0x7E, 0x3C, // C
+  0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC, // D
+  0xFF, 0xFF, 0xC0, 0xC0, 0xFC, 0xFC, 0xC0, 0xC0, 0xFF, 0xFF, // E
+  0xFF, 0xFF, 0xC0, 0xC0, 0xFC, 0xFC, 0xC0, 0xC0, 0xC0, 0xC0  // F
+};
 
+Chip8::Chip8() : rngSeed(0), audio(NULL), toneOn(false),
+  engine(ENGINE_INTERPRETER), romDigest(0), stats(NULL), countedSequence(0),
+  profiler(NULL), warnings(true)
+{
+  setQuirks(QUIRKS_DEFAULT);
+};
+
+Chip8::~Chip8()
+{
+};
+
+void Chip8::initialize()
+{
   pc     = 0x200;  // Program counter starts at 0x200
   opcode = 0;      // Reset current opcode  
   I      = 0;      // Reset index register
   sp     = 0;      // Reset stack pointer
 
-  // Clear display
-  fill(gfx, gfx + sizeof(gfx), 0);
+  // Clear display, back to low-res drawing on plane 0
+  fill(&gfx[0][0][0], &gfx[0][0][0] + 2 * 64 * 2, 0);
+  hires = false;
+  planes = 1;
+  dirtyRows = ~0ULL;
+  frameSequence = 0;
+  countedSequence = 0;
+
+  fill(rpl, rpl + 16, 0);
+  fill(audioPattern, audioPattern + 16, 0);
+  pitch = 64;
+  setPattern();
+  exited = false;
+  faulted = FAULT_NONE;
 
   // Clear stack
-  fill(stack, stack + sizeof(stack), 0);
+  fill(stack, stack + 16, 0);
   // Clear registers V0-VF
   fill(V, V + sizeof(V), 0);
   // Clear memory
   fill(memory, memory + sizeof(memory), 0);
  
-  // Load fontset
+  // Load fontsets
   for(int i = 0; i < 80; ++i){
     memory[i] = chip8Fontset[i];
   }
+  copy(bigFontset, bigFontset + 160, memory + bigFontAddress);
+  // (only code at 0x200-0xFFF is ever decoded)
+  invalidate(0, 0x1000);
+  fill(writtenPages, writtenPages + 4, ~0ULL);
+
+  restartRandom();
 
   // Reset timers
   delay_timer = 0;
   sound_timer = 0;
+  setTone(false);
+
+  // No keys held
+  keypad = 0;
+
+  drawFlag = false;
+};
+
+const char * faultName(Fault fault){
+  static const char * const names[FAULTS] =
+  {
+    "none", "stack overflow", "stack underflow", "pc out of range"
+  };
+  return fault < FAULTS ? names[fault] : "unknown";
 };
 
 void Chip8::unknownOpcode(){
-  if (opcode != 0x0000){ // Empty bytes in memory after program finishes
+  // Empty bytes in memory after program finishes are left alone
+  if (warnings && opcode != 0x0000){
     printf("Unknown opcode 0x%.4X\n", opcode);
   }
 };
 
 bool Chip8::emulateCycle(){
+  return (this->*interpreter)(1) == 1;
+};
+
+// The interpreter, compiled once per quirk profile (see quirks.h), and again
+// for counting each instruction into stats
+template <QuirkProfile P, bool counting>
+unsigned int Chip8::interpret(unsigned int cycles){
+  for (unsigned int i = 0; i < cycles; i++){
+    if (counting && pc < 4096){
+      stats->pcCycles[pc]++;
+      stats->opcodes[opcodeClass(memory[pc] << 8 | memory[pc + 1])]++;
+    }
+    if (!step<P, counting>())
+      return i;
+  }
+  return cycles;
+};
+
+template <QuirkProfile P, bool counting>
+bool Chip8::step(){
+  constexpr Quirks quirks = quirksOf(P);
+
   //Fetch opcode
   if (pc >= 4096)
-    return false;
+    return stop(FAULT_PC_OUT_OF_RANGE);
   opcode = memory[pc] << 8 | memory[pc + 1];
-  drawFlag = false;
 
   //Decode opcode
   switch(opcode & 0xF000){
     case 0x0000:
       switch(opcode & 0x00FF){
       case 0x00E0: // 0x00E0: Clears the screen        
-        fill(gfx, gfx + sizeof(gfx), 0);
-        drawFlag = true;
+        clearScreen();
         pc += 2;
         break;
  
       case 0x00EE: // 0x00EE: Returns from subroutine          
+        if (sp == 0 || sp > 16)
+          return stop(FAULT_STACK_UNDERFLOW);
         sp--;
         pc = stack[sp] + 2;
         break;
 
-      default: // 0000 or 0NNN (Hopefully we don't need either...)
-        unknownOpcode();
+      case 0x00FB: // 00FB: Scrolls the screen right 4 pixels (SUPER-CHIP)
+        scrollRight(4);
+        pc += 2;
+        break;
+
+      case 0x00FC: // 00FC: Scrolls the screen left 4 pixels (SUPER-CHIP)
+        scrollRight(-4);
+        pc += 2;
+        break;
+
+      // 00FD: Exits the interpreter (SUPER-CHIP). pc stays put, so the
+      // program stays stopped
+      case 0x00FD:
+        exited = true;
+        return false;
+
+      case 0x00FE: // 00FE: Switches to 64x32 low-res mode (SUPER-CHIP)
+        setResolution(false);
+        pc += 2;
+        break;
+
+      case 0x00FF: // 00FF: Switches to 128x64 high-res mode (SUPER-CHIP)
+        setResolution(true);
+        pc += 2;
+        break;
+
+      default:
+        // 00CN: Scrolls the screen down N rows (SUPER-CHIP)
+        // 00DN: Scrolls the screen up N rows (XO-CHIP)
+        if ((opcode & 0xFFF0) == 0x00C0){
+          scrollDown(opcode & 0x000F);
+        } else if ((opcode & 0xFFF0) == 0x00D0){
+          scrollDown(-(opcode & 0x000F));
+        } else { // 0000 or 0NNN (Hopefully we don't need either...)
+          unknownOpcode();
+        }
         pc += 2;
         break;
       }
@@ -101,6 +217,8 @@ bool Chip8::emulateCycle(){
       break;
 
     case 0x2000: // 2NNN: Calls subroutine at address NNN
+      if (sp >= 16)
+        return stop(FAULT_STACK_OVERFLOW);
       stack[sp] = pc;
       sp++;
       pc = opcode & 0x0FFF;
@@ -108,14 +226,14 @@ bool Chip8::emulateCycle(){
 
     case 0x3000: // 3XNN: Skips the next instruction if VX equals NN
       if (V[(opcode & 0x0F00) >> 8] == (opcode & 0x00FF))
-        pc += 4;
+        skipNext<P>();
       else
         pc += 2;
       break;
 
     case 0x4000: // 4XNN: Skips the next instruction if VX doesn't equal NN
       if (V[(opcode & 0x0F00) >> 8] != (opcode & 0x00FF))
-        pc += 4;
+        skipNext<P>();
       else
         pc += 2;
       break;
@@ -124,11 +242,33 @@ bool Chip8::emulateCycle(){
       switch (opcode & 0xF00F){ // Check last byte
         case 0x5000: // 5XY0: Skips the next instruction if VX equals VY
           if (V[(opcode & 0x0F00) >> 8] == V[(opcode & 0x00F0) >> 4])
-            pc += 4;
+            skipNext<P>();
           else
             pc += 2;
           break;
 
+        // 5XY2: Stores VX to VY (in either order) in memory starting at
+        // address I, leaving I alone (XO-CHIP)
+        case 0x5002:
+        // 5XY3: Fills VX to VY from memory starting at address I (XO-CHIP)
+        case 0x5003: {
+          unsigned char x = (opcode & 0x0F00) >> 8;
+          unsigned char y = (opcode & 0x00F0) >> 4;
+          int step = x <= y ? 1 : -1;
+          for (int i = 0, r = x; ; i++, r += step){
+            if ((opcode & 0x000F) == 2)
+              memory[(I + i) & 0xFFFF] = V[r];
+            else
+              V[r] = memory[(I + i) & 0xFFFF];
+            if (r == y)
+              break;
+          }
+          if ((opcode & 0x000F) == 2)
+            invalidate(I, (x <= y ? y - x : x - y) + 1);
+          pc += 2;
+          break;
+        }
+
         default:
           unknownOpcode();
           pc += 2;
@@ -155,16 +295,22 @@ bool Chip8::emulateCycle(){
 
         case 0x8001: // 8XY1: Sets VX to VX or VY
           V[(opcode & 0x0F00) >> 8] |= V[(opcode & 0x00F0) >> 4];
+          if (quirks.logicResetsVF)
+            V[0xF] = 0;
           pc += 2;
           break;
 
         case 0x8002: // 8XY2: Sets VX to VX and VY
           V[(opcode & 0x0F00) >> 8] &= V[(opcode & 0x00F0) >> 4];
+          if (quirks.logicResetsVF)
+            V[0xF] = 0;
           pc += 2;
           break;
 
         case 0x8003: // 8XY3: Sets VX to VX xor VY
           V[(opcode & 0x0F00) >> 8] ^= V[(opcode & 0x00F0) >> 4];
+          if (quirks.logicResetsVF)
+            V[0xF] = 0;
           pc += 2;
           break;
 
@@ -192,11 +338,17 @@ bool Chip8::emulateCycle(){
 
         // 8XY6: Shifts VX right by one. VF is set to the value of the least
         // significant bit of VX before the shift
-        case 0x8006:
-          V[0xF] = V[(opcode & 0x0F00) >> 8] & 1;
-          V[(opcode & 0x0F00) >> 8] = V[(opcode & 0x0F00) >> 8] >> 1;
+        // (or with the shiftVY quirk, sets VX to VY shifted right by one)
+        // VF is written last, so it's the flag that's left if X is F, and
+        // the old VF that's shifted if Y is
+        case 0x8006: {
+          unsigned char source = quirks.shiftVY ?
+            V[(opcode & 0x00F0) >> 4] : V[(opcode & 0x0F00) >> 8];
+          V[(opcode & 0x0F00) >> 8] = source >> 1;
+          V[0xF] = source & 1;
           pc += 2;
           break;
+        }
 
         // 8XY7: Sets VX to VY minus VX. VF is set to 0 when there's a borrow,
         // and 1 when there isn't
@@ -212,11 +364,15 @@ bool Chip8::emulateCycle(){
 
         // 8XYE: Shifts VX left by one. VF is set to the value of the most
         // significant bit of VX before the shift
-        case 0x800E:
-          V[0xF] = (V[(opcode & 0x0F00) >> 8] & (1 << 7)) >> 7;
-          V[(opcode & 0x0F00) >> 8] = V[(opcode & 0x0F00) >> 8] << 1;
+        // (or with the shiftVY quirk, sets VX to VY shifted left by one)
+        case 0x800E: {
+          unsigned char source = quirks.shiftVY ?
+            V[(opcode & 0x00F0) >> 4] : V[(opcode & 0x0F00) >> 8];
+          V[(opcode & 0x0F00) >> 8] = source << 1;
+          V[0xF] = (source & (1 << 7)) >> 7;
           pc += 2;
           break;
+        }
 
         default:
           unknownOpcode();
@@ -229,7 +385,7 @@ bool Chip8::emulateCycle(){
       switch (opcode & 0xF00F){ // check last byte
         case 0x9000: // 9XY0: Skips the next instruction if VX doesn't equal VY
           if (V[(opcode & 0x0F00) >> 8] != V[(opcode & 0x00F0) >> 4])
-            pc += 4;
+            skipNext<P>();
           else
             pc += 2;
           break;
@@ -247,54 +403,33 @@ bool Chip8::emulateCycle(){
       break;
 
     case 0xB000: // BNNN: Jumps to the address NNN plus V0
-      pc = (opcode & 0x0FFF) + V[0];
+      if (quirks.jumpVX) // BXNN: Jumps to XNN plus VX
+        pc = (opcode & 0x0FFF) + V[(opcode & 0x0F00) >> 8];
+      else
+        pc = (opcode & 0x0FFF) + V[0];
       break;
 
     // CXNN: Sets VX to the result of a bitwise and operation on a random number
     // and NN
     case 0xC000:
-      V[(opcode & 0x0F00) >> 8] = (rand() % 256) & (opcode & 0x00FF);
+      V[(opcode & 0x0F00) >> 8] = nextRandom() & (opcode & 0x00FF);
       pc += 2;
       break;
 
-    /* DXYN: Sprites stored in memory at location in index register (I), 8bits
-       wide. Wraps around the screen. If when drawn, clears a pixel, register VF
-       is set to 1 otherwise it is zero. All drawing is XOR drawing (i.e. it
-       toggles the screen pixels). Sprites are drawn starting at position VX,
-       VY. N is the number of 8bit rows that need to be drawn. If N is greater
-       than 1, second line continues at position VX, VY+1, and so on. */
-    case 0xD000: {
-      unsigned short x = V[(opcode & 0x0F00) >> 8];
-      unsigned short y = V[(opcode & 0x00F0) >> 4];
-      unsigned short height = opcode & 0x000F;
-      unsigned short pixel;
-     
-      V[0xF] = 0;
-      for (int yline = 0; yline < height; yline++)
-      {
-        pixel = memory[I + yline];
-        for (int xline = 0; xline < 8; xline++)
-        {
-          if ((pixel & (0x80 >> xline)) != 0)
-          {
-            if (gfx[(x + xline + ((y + yline) * 64))] == 1)
-              V[0xF] = 1;                                 
-            gfx[x + xline + ((y + yline) * 64)] ^= 1;
-          }
-        }
-      }
-
-      drawFlag = true;
+    // DXYN: Draws the N row sprite at I to VX, VY, setting VF on collision.
+    // DXY0 draws a 16x16 sprite (SUPER-CHIP)
+    case 0xD000:
+      drawSprite<P, counting>(V[(opcode & 0x0F00) >> 8],
+        V[(opcode & 0x00F0) >> 4], opcode & 0x000F);
       pc += 2;
       break;
-    }
 
     case 0xE000:
       switch (opcode & 0xF0FF){
         // EX9E: Skips the next instruction if the key stored in VX is pressed
         case 0xE09E:
-          if (keypad[V[(opcode & 0x0F00) >> 8]] == 1)
-            pc += 4;
+          if (keyHeld(V[(opcode & 0x0F00) >> 8]))
+            skipNext<P>();
           else
             pc += 2;
           break;
@@ -302,8 +437,8 @@ bool Chip8::emulateCycle(){
         // EXA1: Skips the next instruction if the key stored in VX isn't
         // pressed
         case 0xE0A1:
-          if (keypad[V[(opcode & 0x0F00) >> 8]] == 0)
-            pc += 4;
+          if (!keyHeld(V[(opcode & 0x0F00) >> 8]))
+            skipNext<P>();
           else
             pc += 2;
           break;
@@ -317,6 +452,38 @@ bool Chip8::emulateCycle(){
 
     case 0xF000:
       switch(opcode & 0xF0FF){
+        // F000 NNNN: Sets I to the 16 bit address in the next two bytes
+        // (XO-CHIP only)
+        case 0xF000:
+          if (opcode != 0xF000 || !quirksOf(P).longLoad){
+            unknownOpcode();
+            pc += 2;
+            break;
+          }
+          I = memory[(pc + 2) & 0xFFFF] << 8 | memory[(pc + 3) & 0xFFFF];
+          pc += 4;
+          break;
+
+        // FN01: Selects the planes that drawing, clearing and scrolling apply
+        // to, plane 0 for N = 1, plane 1 for N = 2 and both for N = 3 (XO-CHIP)
+        case 0xF001:
+          planes = (opcode & 0x0F00) >> 8 & 3;
+          pc += 2;
+          break;
+
+        // F002: Loads the 16 byte audio pattern from I (XO-CHIP)
+        case 0xF002:
+          if (opcode != 0xF002){
+            unknownOpcode();
+            pc += 2;
+            break;
+          }
+          for (unsigned char i = 0; i < 16; i++)
+            audioPattern[i] = memory[(I + i) & 0xFFFF];
+          setPattern();
+          pc += 2;
+          break;
+
         case 0xF007: // FX07: Sets VX to the value of the delay timer
           V[(opcode & 0x0F00) >> 8] = delay_timer;
           pc += 2;
@@ -324,7 +491,7 @@ bool Chip8::emulateCycle(){
 
         case 0xF00A: // FX0A: A key press is awaited, and then stored in VX
           for (unsigned char i = 0; i < 16; i++){
-            if (keypad[i] == 1){
+            if (keyHeld(i)){
               V[(opcode & 0x0F00) >> 8] = i;
               pc += 2;
               break;
@@ -333,12 +500,12 @@ bool Chip8::emulateCycle(){
           break;
 
         case 0xF015: // FX15: Sets the delay timer to VX
-          delay_timer = V[(opcode & 0x0F00) >> 8] + 1;
+          delay_timer = V[(opcode & 0x0F00) >> 8];
           pc += 2;
           break;
 
         case 0xF018: // FX18: Sets the sound timer to VX
-          sound_timer = V[(opcode & 0x0F00) >> 8] + 1;
+          sound_timer = V[(opcode & 0x0F00) >> 8];
           pc += 2;
           break;
 
@@ -354,6 +521,19 @@ bool Chip8::emulateCycle(){
           pc += 2;
           break;
 
+        // FX30: Sets I to the 8x10 sprite for the digit in VX (SUPER-CHIP)
+        case 0xF030:
+          I = bigFontAddress + (V[(opcode & 0x0F00) >> 8] & 0xF) * 10;
+          pc += 2;
+          break;
+
+        // FX3A: Sets the pitch of the audio pattern to VX (XO-CHIP)
+        case 0xF03A:
+          pitch = V[(opcode & 0x0F00) >> 8];
+          setPattern();
+          pc += 2;
+          break;
+
         // FX33: Stores the Binary-coded decimal representation of VX, with the
         // most significant of three digits at the address in I, the middle
         // digit at I plus 1, and the least significant digit at I plus 2. (In
@@ -362,16 +542,20 @@ bool Chip8::emulateCycle(){
         // I+1, and the ones digit at location I+2.)
         case 0xF033:
           memory[I] = V[(opcode & 0x0F00) >> 8] / 100;
-          memory[I + 1] = (V[(opcode & 0x0F00) >> 8] / 10) % 10;
-          memory[I + 2] = (V[(opcode & 0x0F00) >> 8] % 100) % 10;
+          memory[(I + 1) & 0xFFFF] = (V[(opcode & 0x0F00) >> 8] / 10) % 10;
+          memory[(I + 2) & 0xFFFF] = (V[(opcode & 0x0F00) >> 8] % 100) % 10;
+          invalidate(I, 3);
           pc += 2;
           break;
 
         // FX55: Stores V0 to VX (including VX) in memory starting at address I
         case 0xF055:
           for (unsigned char i = 0; i <= (opcode & 0x0F00) >> 8; i++){
-            memory[I + i] = V[i];
+            memory[(I + i) & 0xFFFF] = V[i];
           }
+          invalidate(I, ((opcode & 0x0F00) >> 8) + 1);
+          if (quirks.index != INDEX_KEEP)
+            I += ((opcode & 0x0F00) >> 8) + (quirks.index == INDEX_PLUS_X_PLUS_1);
           pc += 2;
           break;
 
@@ -379,8 +563,29 @@ bool Chip8::emulateCycle(){
         // at address I
         case 0xF065:
           for (unsigned char i = 0; i <= (opcode & 0x0F00) >> 8; i++){
-            V[i] = memory[I + i];
+            V[i] = memory[(I + i) & 0xFFFF];
           }
+          if (quirks.index != INDEX_KEEP)
+            I += ((opcode & 0x0F00) >> 8) + (quirks.index == INDEX_PLUS_X_PLUS_1);
+          pc += 2;
+          break;
+
+        // FX75: Saves V0 to VX (X up to F) to the RPL flags (SUPER-CHIP)
+        case 0xF075:
+          for (unsigned char i = 0; i <= (opcode & 0x0F00) >> 8; i++)
+            rpl[i] = V[i];
+          pc += 2;
+          break;
+
+        // FX85: Restores V0 to VX from the RPL flags (SUPER-CHIP)
+        case 0xF085:
+          for (unsigned char i = 0; i <= (opcode & 0x0F00) >> 8; i++)
+            V[i] = rpl[i];
+          pc += 2;
+          break;
+
+        default:
+          unknownOpcode();
           pc += 2;
           break;
       }
@@ -392,76 +597,523 @@ bool Chip8::emulateCycle(){
       break;
   }
 
+  return true;
+};
+
+/* Sprites stored in memory at location in index register (I), 8bits wide.
+   Wraps around the screen. If when drawn, clears a pixel, register VF is set
+   to 1 otherwise it is zero. All drawing is XOR drawing (i.e. it toggles the
+   screen pixels). Sprites are drawn starting at position x, y; height is the
+   number of 8bit rows that need to be drawn.
+
+   Each sprite row is moved to the left edge of a screen row and rotated
+   right by x, so the pixels that fall off the right edge come back in on the
+   left, then XORed in one go. Low-res rows are one 64 bit word and high-res
+   rows two, rotated as a 128 bit value.
+
+   A height of 0 draws a 16x16 sprite, two bytes per row. With both planes
+   selected, plane 1's sprite follows plane 0's in memory.
+
+   With the clipSprites quirk, the rows are shifted rather than rotated, so
+   what goes past the right edge is lost, and rows past the bottom are
+   skipped */
+template <QuirkProfile P, bool counting>
+void Chip8::drawSprite(unsigned char x, unsigned char y, unsigned char height){
+  constexpr Quirks quirks = quirksOf(P);
+  unsigned int screenWidth = hires ? 128 : 64;
+  unsigned int screenHeight = hires ? 64 : 32;
+  x %= screenWidth;
+  y %= screenHeight;
+
+  bool wide = height == 0;
+  if (wide)
+    height = 16;
+
+  unsigned short address = I;
+  // rows that hit something, and rows cut off at the bottom
+  unsigned char collisions = 0;
+  unsigned char clipped = 0;
+  for (int p = 0; p < 2; p++){
+    if ((planes & (1 << p)) == 0)
+      continue;
+
+    for (int yline = 0; yline < height; yline++){
+      uint64_t left = (uint64_t)memory[address] << 56;
+      address++;
+      if (wide){
+        left |= (uint64_t)memory[address] << 48;
+        address++;
+      }
+
+      unsigned char r = y + yline;
+      if (r >= screenHeight){
+        if (quirks.clipSprites){
+          clipped++;
+          continue;
+        }
+        r %= screenHeight;
+      }
+
+      uint64_t * row = gfx[p][r];
+      if (!hires){
+        if (quirks.clipSprites)
+          left >>= x;
+        else if (x != 0)
+          left = (left >> x) | (left << (64 - x));
+        if ((row[0] & left) != 0)
+          collisions++;
+        row[0] ^= left;
+        if (counting)
+          stats->pixels += __builtin_popcountll(left);
+      } else {
+        uint64_t right = 0;
+        unsigned char shift = x;
+        if (shift >= 64){
+          right = left;
+          left = 0;
+          shift -= 64;
+        }
+        if (shift != 0){
+          uint64_t carry = quirks.clipSprites ? 0 : right << (64 - shift);
+          right = (right >> shift) | (left << (64 - shift));
+          left = (left >> shift) | carry;
+        }
+        if ((row[0] & left) != 0 || (row[1] & right) != 0)
+          collisions++;
+        row[0] ^= left;
+        row[1] ^= right;
+        if (counting)
+          stats->pixels += __builtin_popcountll(left) +
+            __builtin_popcountll(right);
+        left |= right;
+      }
+      if (left != 0)
+        dirtyRows |= 1ULL << r;
+    }
+  }
+  if (quirks.countCollisions && hires)
+    V[0xF] = collisions + clipped;
+  else
+    V[0xF] = collisions != 0;
+
+  if (counting)
+    stats->draws++;
+  drawFlag = true;
+  frameSequence++;
+};
+
+// The cached engine's draw handlers use these too
+template void Chip8::drawSprite<QUIRKS_DEFAULT>(unsigned char, unsigned char,
+  unsigned char);
+template void Chip8::drawSprite<QUIRKS_VIP>(unsigned char, unsigned char,
+  unsigned char);
+template void Chip8::drawSprite<QUIRKS_CHIP48>(unsigned char, unsigned char,
+  unsigned char);
+template void Chip8::drawSprite<QUIRKS_SCHIP>(unsigned char, unsigned char,
+  unsigned char);
+template void Chip8::drawSprite<QUIRKS_XOCHIP>(unsigned char, unsigned char,
+  unsigned char);
+
+void Chip8::clearScreen(){
+  for (int p = 0; p < 2; p++){
+    if ((planes & (1 << p)) == 0)
+      continue;
+    for (unsigned char y = 0; y < 64; y++){
+      if ((gfx[p][y][0] | gfx[p][y][1]) != 0)
+        dirtyRows |= 1ULL << y;
+      gfx[p][y][0] = 0;
+      gfx[p][y][1] = 0;
+    }
+  }
+  drawFlag = true;
+  frameSequence++;
+};
+
+void Chip8::setResolution(bool high){
+  // Switching clears both planes, whichever are selected
+  hires = high;
+  fill(&gfx[0][0][0], &gfx[0][0][0] + 2 * 64 * 2, 0);
+  dirtyRows = ~0ULL;
+  drawFlag = true;
+  frameSequence++;
+};
+
+// Scrolls the selected planes down (or up, if rows is negative), filling in
+// with blank rows
+void Chip8::scrollDown(int rows){
+  int screenHeight = hires ? 64 : 32;
+  for (int p = 0; p < 2; p++){
+    if ((planes & (1 << p)) == 0)
+      continue;
+    for (int i = 0; i < screenHeight; i++){
+      // Go against the direction of the scroll so rows aren't overwritten
+      // before they've been moved
+      int y = rows > 0 ? screenHeight - 1 - i : i;
+      int from = y - rows;
+      bool inside = from >= 0 && from < screenHeight;
+      gfx[p][y][0] = inside ? gfx[p][from][0] : 0;
+      gfx[p][y][1] = inside ? gfx[p][from][1] : 0;
+    }
+  }
+  dirtyRows |= ~0ULL >> (64 - screenHeight);
+  drawFlag = true;
+  frameSequence++;
+};
+
+// Scrolls the selected planes right (or left, if pixels is negative) by
+// 1 to 63 pixels, filling in with blank pixels
+void Chip8::scrollRight(int pixels){
+  int screenHeight = hires ? 64 : 32;
+  for (int p = 0; p < 2; p++){
+    if ((planes & (1 << p)) == 0)
+      continue;
+    for (int y = 0; y < screenHeight; y++){
+      uint64_t & left = gfx[p][y][0];
+      uint64_t & right = gfx[p][y][1];
+      if (!hires){
+        left = pixels > 0 ? left >> pixels : left << -pixels;
+      } else if (pixels > 0){
+        right = (right >> pixels) | (left << (64 - pixels));
+        left >>= pixels;
+      } else {
+        left = (left << -pixels) | (right >> (64 + pixels));
+        right <<= -pixels;
+      }
+    }
+  }
+  dirtyRows |= ~0ULL >> (64 - screenHeight);
+  drawFlag = true;
+  frameSequence++;
+};
+
+unsigned int Chip8::run(unsigned int cycles){
+  if (profiler == NULL)
+    return runBatch(cycles);
+
+  // Stopping at each sample point on the way through. Runs in pieces end up
+  // the same as one run, down to the wait loop shortcuts below
+  unsigned int ran = 0;
+  while (ran < cycles){
+    unsigned int piece = cycles - ran;
+    if (piece > profiler->untilSample())
+      piece = profiler->untilSample();
+    unsigned int done = runBatch(piece);
+    profiler->advance(*this, done);
+    ran += done;
+    if (done < piece)
+      break;
+  }
+  return ran;
+};
+
+unsigned int Chip8::runBatch(unsigned int cycles){
+  // A jump to itself, or FX0A with no key held, stays put until the keys
+  // are next read, which is after the batch
+  if (halted() || awaitingKey()){
+    if (stats != NULL)
+      stats->waited += cycles;
+    return cycles;
+  }
+
+  // If the program is partway round a loop waiting on the delay timer, step
+  // to the top of it and skip the rest of the batch
+  unsigned int ran = 0;
+  while (ran < cycles && !waitLoop(pc) &&
+      (waitLoop(pc - 2) || waitLoop(pc - 4))){
+    if (runEngine(1) == 0)
+      return ran;
+    ran++;
+  }
+  if (ran < cycles && waitLoop(pc))
+    return ran + skipWait(cycles - ran);
+
+  return ran + runEngine(cycles - ran);
+};
+
+unsigned int Chip8::runEngine(unsigned int cycles){
+  if (engine == ENGINE_INTERPRETER || stats != NULL)
+    return (this->*interpreter)(cycles);
+  if (engine == ENGINE_CACHED)
+    return runCached(cycles);
+  return runJit(cycles);
+};
+
+/* Programs usually wait for the delay timer with
+
+     loop: FX07       VX = delay timer
+           3XNN       skip the jump once VX == NN (or 4XNN, once VX != NN)
+           1loop
+
+   The timers only tick between batches, so once a program is at the top of
+   such a loop it can't leave it before the batch ends. Instead of running
+   it, the registers are set to what running it would have left them as */
+bool Chip8::waitLoop(unsigned short address){
+  if (address < 0x200 || address > 4096 - 6)
+    return false;
+  const unsigned char * code = memory + address;
+  unsigned char x = code[0] & 0x0F;
+  if ((code[0] & 0xF0) != 0xF0 || code[1] != 0x07 ||
+      (code[2] != (0x30 | x) && code[2] != (0x40 | x)) ||
+      (code[4] << 8 | code[5]) != (0x1000 | address))
+    return false;
+
+  // Would the skip take it out of the loop?
+  bool equal = delay_timer == code[3];
+  return (code[2] & 0xF0) == 0x30 ? !equal : equal;
+};
+
+bool Chip8::halted(){
+  return pc <= 4096 - 2 && (memory[pc] << 8 | memory[pc + 1]) == (0x1000 | pc);
+};
+
+bool Chip8::awaitingKey(){
+  if (pc > 4096 - 2 || (memory[pc] & 0xF0) != 0xF0 || memory[pc + 1] != 0x0A)
+    return false;
+  return keypad == 0;
+};
+
+WaitState Chip8::waitState(){
+  bool timerWait = waitLoop(pc) || waitLoop(pc - 2) || waitLoop(pc - 4);
+  if (!timerWait && !halted() && !awaitingKey())
+    return WAIT_NONE;
+  // While the timers run there's still the tone and FX07 to keep up with
+  if (timerWait || delay_timer > 0 || sound_timer > 0)
+    return WAIT_TIMER;
+  return halted() ? WAIT_FOREVER : WAIT_KEY;
+};
+
+unsigned int Chip8::skipWait(unsigned int cycles){
+  // Every time round, VX is set to the (unchanging) delay timer, and the
+  // batch ends after whole trips round the loop plus cycles % 3 instructions
+  V[memory[pc] & 0x0F] = delay_timer;
+  pc += 2 * (cycles % 3);
+  if (stats != NULL)
+    stats->waited += cycles;
+  return cycles;
+};
+
+void Chip8::setEngine(Engine e){
+  engine = e;
+  if (engine == ENGINE_JIT && !jit){
+    jit.reset(new Jit());
+    if (!jit->available())
+      printf("JIT not available on this platform, using the cached engine\n");
+  }
+};
+
+void Chip8::setQuirks(QuirkProfile profile){
+  quirks = profile;
+  selectInterpreter();
+  // Throws away everything decoded or translated under the old profile
+  selectDecoder();
+};
+
+void Chip8::selectInterpreter(){
+  static unsigned int (Chip8::* const interpreters[2][QUIRK_PROFILES])(
+      unsigned int) = {
+    {
+      &Chip8::interpret<QUIRKS_DEFAULT, false>,
+      &Chip8::interpret<QUIRKS_VIP, false>,
+      &Chip8::interpret<QUIRKS_CHIP48, false>,
+      &Chip8::interpret<QUIRKS_SCHIP, false>,
+      &Chip8::interpret<QUIRKS_XOCHIP, false>
+    }, {
+      &Chip8::interpret<QUIRKS_DEFAULT, true>,
+      &Chip8::interpret<QUIRKS_VIP, true>,
+      &Chip8::interpret<QUIRKS_CHIP48, true>,
+      &Chip8::interpret<QUIRKS_SCHIP, true>,
+      &Chip8::interpret<QUIRKS_XOCHIP, true>
+    }
+  };
+  interpreter = interpreters[stats != NULL][quirks];
+};
+
+void Chip8::attachStats(Stats * s){
+  stats = s;
+  selectInterpreter();
+};
+
+void Chip8::attachProfiler(Profiler * p){
+  profiler = p;
+};
+
+void Chip8::setWarnings(bool on){
+  warnings = on;
+};
+
+QuirkProfile Chip8::quirkProfile(){
+  return quirks;
+};
+
+void Chip8::tickTimers(){
+  // Called once per 60Hz frame by the scheduler, independent of how many
+  // instructions were run during that frame
   if(delay_timer > 0){
     --delay_timer;
   }
  
   if(sound_timer > 0){
-    if(sound_timer == 1)
-      printf("BEEP!\n");
-      // TODO: make this play sound (why is it so hard to play sound in SDL...)
     --sound_timer;
   }
 
-  return true;
+  if (stats != NULL){
+    stats->frames++;
+    if (frameSequence != countedSequence)
+      stats->drawnFrames++;
+    countedSequence = frameSequence;
+  }
+
+  // The tone plays for as long as the sound timer is running
+  setTone(sound_timer > 0);
 };
 
-void Chip8::render(Gpu gpu){
-  gpu.render(gfx);
+unsigned char Chip8::nextRandom(){
+  rngState ^= rngState >> 12;
+  rngState ^= rngState << 25;
+  rngState ^= rngState >> 27;
+  return (rngState * 0x2545F4914F6CDD1DULL) >> 56;
 };
 
-void Chip8::loadGame(string name){
-  ifstream file;
-  file.open(name, ios::in|ios::binary|ios::ate);
-  assert(file.is_open());
+void Chip8::restartRandom(){
+  // The seed is run through splitmix64 first, since xorshift needs a well
+  // mixed, non-zero state
+  rngState = rngSeed + 0x9E3779B97F4A7C15ULL;
+  rngState = (rngState ^ (rngState >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  rngState = (rngState ^ (rngState >> 27)) * 0x94D049BB133111EBULL;
+  rngState ^= rngState >> 31;
+  if (rngState == 0)
+    rngState = 1;
+};
 
-  streampos size;
-  size = file.tellg();
-  printf("Loading rom '%s' (%i bytes)...\n", name.c_str(), int(size));
+void Chip8::seed(uint64_t value){
+  rngSeed = value;
+  restartRandom();
+};
 
-  file.seekg (0, ios::beg);
-  char * memblock;
+void Chip8::setTone(bool on){
+  if (on == toneOn)
+    return;
+  toneOn = on;
+  if (audio != NULL)
+    audio->setTone(on);
+};
 
-  for (int i = 0; file.tellg() != size; i++) {
-    memblock = new char;
-    file.read(memblock, 1);
-    memory[i + 0x200] = (unsigned char)(*memblock);
-  }
+void Chip8::setPattern(){
+  if (audio == NULL)
+    return;
+  bool loaded = false;
+  for (unsigned char i = 0; i < 16; i++)
+    loaded = loaded || audioPattern[i] != 0;
+  audio->setPattern(loaded ? audioPattern : NULL, pitch);
+};
 
-  file.close();
+void Chip8::attachAudio(AudioSink * sink){
+  audio = sink;
+  setPattern();
 };
 
-/* Keymapping:
+FrameView Chip8::getFrame(){
+  FrameView frame;
+  frame.planes[0] = &gfx[0][0][0];
+  frame.planes[1] = &gfx[1][0][0];
+  frame.width = hires ? 128 : 64;
+  frame.height = hires ? 64 : 32;
+  frame.dirtyRows = dirtyRows;
+  frame.sequence = frameSequence;
 
-Keypad                 Keyboard
-1|2|3|C       -->      1|2|3|4
-4|5|6|D       -->      Q|W|E|R
-7|8|9|E       -->      A|S|D|F
-A|0|B|F       -->      Z|X|C|V
+  dirtyRows = 0;
+  drawFlag = false;
+  return frame;
+};
 
-keymap[x] = keypad[x] - so keymap[0xA] is the scancode for button A
-(scancodes: https://wiki.libsdl.org/SDL_Scancode) */
+uint64_t Chip8::screenHash(){
+  // 64 bit FNV-1a over the rows in use, top to bottom and left to right.
+  // Plane 1 only counts once something has been drawn to it, so plain chip8
+  // screens hash the same as they always have
+  unsigned char height = hires ? 64 : 32;
+  unsigned char words = hires ? 2 : 1;
+  uint64_t plane1 = 0;
+  for (unsigned char y = 0; y < 64; y++)
+    plane1 |= gfx[1][y][0] | gfx[1][y][1];
+
+  uint64_t hash = 0xCBF29CE484222325ULL;
+  for (int p = 0; p < (plane1 != 0 ? 2 : 1); p++){
+    for (unsigned char y = 0; y < height; y++){
+      for (unsigned char w = 0; w < words; w++){
+        for (int shift = 56; shift >= 0; shift -= 8){
+          hash ^= (gfx[p][y][w] >> shift) & 0xFF;
+          hash *= 0x100000001B3ULL;
+        }
+      }
+    }
+  }
+  return hash;
+};
 
-Uint8 keymap[16] =
-{
-  SDL_SCANCODE_X, SDL_SCANCODE_1, SDL_SCANCODE_2, SDL_SCANCODE_3, // 0-3
-  SDL_SCANCODE_Q, SDL_SCANCODE_W, SDL_SCANCODE_E, SDL_SCANCODE_A, // 4-7
-  SDL_SCANCODE_S, SDL_SCANCODE_D, SDL_SCANCODE_Z, SDL_SCANCODE_C, // 8-B
-  SDL_SCANCODE_4, SDL_SCANCODE_R, SDL_SCANCODE_F, SDL_SCANCODE_V  // C-F
+unsigned int Chip8::romSizeLimit(){
+  return quirks == QUIRKS_XOCHIP ? maxRomSize : 0x1000 - 0x200;
 };
 
+bool Chip8::loadGame(const string & name){
+  ifstream file(name, ios::in|ios::binary|ios::ate);
+  if (!file.is_open()){
+    printf("Could not open rom '%s'\n", name.c_str());
+    return false;
+  }
 
-void Chip8::setKeys(){
-  // SDL keypress states (updated by event loop in main.cpp)
-  const Uint8* currentKeyStates = SDL_GetKeyboardState(NULL);
+  streamoff size = file.tellg();
+  if (size < 0 || size > romSizeLimit()){
+    printf("Rom '%s' is too big (%lld bytes, at most %u fit)\n", name.c_str(),
+      (long long)size, romSizeLimit());
+    return false;
+  }
 
-  for(unsigned char i = 0; i < 16; i++){
-    if(currentKeyStates[keymap[i]])
-      keypad[i] = 1;
-    else
-      keypad[i] = 0;
+  // Read straight into memory in one go
+  file.seekg(0, ios::beg);
+  if (!file.read((char *)memory + 0x200, size)){
+    printf("Could not read rom '%s'\n", name.c_str());
+    return false;
   }
-  keypad[5] = 1;
+  romLoaded(size);
+  return true;
+};
+
+bool Chip8::loadGame(const unsigned char * data, size_t size){
+  if (size > romSizeLimit()){
+    printf("Rom is too big (%zu bytes, at most %u fit)\n", size,
+      romSizeLimit());
+    return false;
+  }
+  copy(data, data + size, memory + 0x200);
+  romLoaded(size);
+  return true;
+};
+
+void Chip8::romLoaded(size_t size){
+  invalidate(0x200, size);
+
+  // 64 bit FNV-1a, like screenHash
+  romDigest = 0xCBF29CE484222325ULL;
+  for (size_t i = 0; i < size; i++){
+    romDigest ^= memory[0x200 + i];
+    romDigest *= 0x100000001B3ULL;
+  }
+};
+
+Fault Chip8::fault(){
+  return faulted;
+};
+
+unsigned short Chip8::faultAddress(){
+  return pc;
+};
+
+uint64_t Chip8::romHash(){
+  return romDigest;
+};
+
+void Chip8::setKeys(InputSource & input){
+  keypad = input.readKeys();
 };
 
 
@@ -472,298 +1124,32 @@ void Chip8::shutdown(){
 
 
 void Chip8::debugRender(){
+  unsigned char width = hires ? 128 : 64;
+  unsigned char height = hires ? 64 : 32;
+  // blank, plane 0, plane 1, both
+  const char shades[] = " #+*";
+
   cout << "+";
-  for(unsigned char i = 0; i < 64; i++){
+  for(unsigned char i = 0; i < width; i++){
     cout << "-";
   }
   cout << "+\n";
 
-  for(unsigned char y = 0; y < 32; y++){
+  for(unsigned char y = 0; y < height; y++){
     cout << "|";
-    for(unsigned char x = 0; x < 64; x++){
-      if (gfx[y * 64 + x] == 1)
-        cout << "#";
-      else
-        cout << " ";
+    for(unsigned char x = 0; x < width; x++){
+      int bit = 63 - x % 64;
+      int colour = ((gfx[0][y][x / 64] >> bit) & 1) |
+        ((gfx[1][y][x / 64] >> bit) & 1) << 1;
+      cout << shades[colour];
     }
     cout << "|\n";
   }
 
   cout << "+";
-  for(unsigned char i = 0; i < 64; i++){
+  for(unsigned char i = 0; i < width; i++){
     cout << "-";
   }
   cout << "+\n";
   cout.flush();
 };
-
-
-void Chip8::runOpcode(unsigned short op){
-  memory[pc] = (op & 0xFF00) >> 8;
-  memory[pc + 1] = op & 0x00FF;
-  emulateCycle();
-};
-
-
-void Chip8::selfTest(){
-  printf("Running unit tests...\n");
-
-  // 00EE: Return from subroutine
-  initialize();
-  sp = 5;
-  stack[4] = 0x400;
-  runOpcode(0x00EE);
-  assert(sp == 4);
-  assert(pc == 0x402);
-
-  // 1NNN: Jump to address NNN
-  runOpcode(0x1765);
-  assert(pc == 0x765);
-
-  // 2NNN: Calls subroutine at NNN
-  initialize();
-  runOpcode(0x2345);
-  assert(pc == 0x345);
-  assert(sp == 1);
-  assert(stack[0] == 0x200);
-
-  // 3XNN: Skips the next instruction if VX equals NN
-  initialize();
-  V[5] = 0xDC;
-  runOpcode(0x35DC);
-  assert(pc = 0x204);
-  runOpcode(0x3511);
-  assert(pc = 0x206);
-
-  // 4XNN: Skips the next instruction if VX doesn't equal NN
-  initialize();
-  V[5] = 0xDC;
-  runOpcode(0x45DC);
-  assert(pc = 0x202);
-  runOpcode(0x4511);
-  assert(pc = 0x206);
-
-  // 5XY0: Skips the next instruction if VX equals VY
-  initialize();
-  V[8] = 0xCC; V[6] = 0xBB; V[5] = 0xCC;
-  runOpcode(0x5860);
-  assert(pc == 0x202);
-  runOpcode(0x5580);
-  assert(pc == 0x206);
-  runOpcode(0x5660);
-  assert(pc == 0x20A);
-
-  // 6XNN: Sets VX to NN
-  initialize();
-  runOpcode(0x63BC);
-  assert(V[3] = 0xBC);
-
-  // 7XNN: Adds NN to VX
-  initialize();
-  V[5] = 58;
-  runOpcode(0x75AB);
-  assert(V[5] = 229);
-
-  // 8XY0: Sets the value of VX to the value of VY
-  initialize();
-  V[2] = 0xAF;
-  runOpcode(0x8920);
-  assert(V[9] = 0xAF);
-
-  // 8XY1: Sets VX to VX or VY
-  initialize();
-  V[7] = 0xDE;
-  V[4] = 0x47;
-  runOpcode(0x8741);
-  assert(V[7] == (0xDE | 0x47));
-
-  // 8XY2: Sets VX to VX and VY
-  initialize();
-  V[7] = 0xDE;
-  V[4] = 0x47;
-  runOpcode(0x8742);
-  assert(V[7] == (0xDE & 0x47));
-
-  // 8XY3: Sets VX to VX xor VY
-  initialize();
-  V[7] = 0xDE;
-  V[4] = 0x47;
-  runOpcode(0x8743);
-  assert(V[7] == (0xDE ^ 0x47));
-
-  // 8XY4:  Adds VY to VX. VF is set to 1 when there's a carry, and to 0
-  // when there isn't
-  initialize();
-  V[7] = 128; V[8] = 128;
-  runOpcode(0x8874);
-  assert(V[0xF] == 1);
-  assert(V[8] == 0);
-  V[7] = 79; V[8] = 115;
-  runOpcode(0x8874);
-  assert(V[0xF] == 0);
-  assert(V[8] == 79 + 115);
-
-  // 8XY5: VY is subtracted from VX. VF is set to 0 when there's a borrow,
-  // and 1 when there isn't
-  initialize();
-  V[7] = 128; V[8] = 128;
-  runOpcode(0x8875);
-  assert(V[0xF] == 1);
-  assert(V[8] == 0);
-  V[7] = 200; V[8] = 100;
-  runOpcode(0x8875);
-  assert(V[0xF] == 0);
-  assert(V[8] == 156);
-
-  // 8XY6: Shifts VX right by one. VF is set to the value of the least
-  // significant bit of VX before the shift
-  initialize();
-  V[2] = 0b01010101;
-  runOpcode(0x82F6);
-  assert(V[2] == 0b00101010);
-  assert(V[0xF] == 1);
-  runOpcode(0x82F6);
-  assert(V[2] == 0b00010101);
-  assert(V[0xF] == 0);
-
-  // 8XY7: Sets VX to VY minus VX. VF is set to 0 when there's a borrow, and 1
-  // when there isn't
-  initialize();
-  V[7] = 128; V[8] = 128;
-  runOpcode(0x8877);
-  assert(V[0xF] == 1);
-  assert(V[8] == 0);
-  V[7] = 100; V[8] = 200;
-  runOpcode(0x8877);
-  assert(V[0xF] == 0);
-  assert(V[8] == 156);
-
-  // 8XYE: Shifts VX left by one. VF is set to the value of the most significant
-  // bit of VX before the shift
-  initialize();
-  V[2] = 0b10101010;
-  runOpcode(0x82FE);
-  assert(V[2] == 0b01010100);
-  assert(V[0xF] == 1);
-  runOpcode(0x82FE);
-  assert(V[2] == 0b10101000);
-  assert(V[0xF] == 0);
-
-  // 9XY0: Skips the next instruction if VX doesn't equal VY
-  initialize();
-  V[4] = 34; V[1] = 54;
-  runOpcode(0x9410);
-  assert(pc == 0x204);
-  V[1] = 34;
-  runOpcode(0x9410);
-  assert(pc == 0x206);
-
-  // ANNN: Set I to NNN
-  initialize();
-  runOpcode(0xAABC);
-  assert(I == 0xABC);
-
-  // BNNN: Jumps to the address NNN plus V0
-  V[0] = 0x43;
-  runOpcode(0xB2BB);
-  assert(pc == 0x43 + 0x2BB);
-
-  // CXNN: Sets VX to the result of a bitwise and operation on a random number
-  // and NN
-  initialize();
-  runOpcode(0xC300 | 0b10101010);
-  assert((V[3] & 0b01010101) == 0);
-
-  // DXYN:
-  // TODO: implement unit tests for this opcode
-
-  // EX9E: Skips the next instruction if the key stored in VX is pressed
-  initialize();
-  V[4] = 0xE; keypad[0xE] = 1;
-  runOpcode(0xE49E);
-  assert(pc == 0x204);
-  keypad[0xE] = 0;
-  runOpcode(0xE49E);
-  assert(pc == 0x206);
-
-  // EXA1: Skips the next instruction if the key stored in VX isn't pressed
-  initialize();
-  V[4] = 0xE; keypad[0xE] = 1;
-  runOpcode(0xE4A1);
-  assert(pc == 0x202);
-  keypad[0xE] = 0;
-  runOpcode(0xE4A1);
-  assert(pc == 0x206);
-
-  // FX07: Sets VX to the value of the delay timer
-  initialize();
-  delay_timer = 120;
-  runOpcode(0xF207);
-  assert(V[2] == 120);
-
-  // FX0A: A key press is awaited, and then stored in VX
-  initialize();
-  runOpcode(0xF60A);
-  assert(pc == 0x200);
-  assert(V[6] == 0);
-  keypad[0xC] = 1;
-  runOpcode(0xF60A);
-  assert(pc == 0x202);
-  assert(V[6] == 0xC);
-  keypad[0xC] = 0;
-
-  // FX15: Sets the delay timer to VX
-  initialize();
-  V[8] = 123;
-  runOpcode(0xF815);
-  assert(delay_timer == 123);
-
-  // FX18: Sets the sound timer to VX
-  initialize();
-  V[8] = 123;
-  runOpcode(0xF818);
-  assert(sound_timer == 123);
-
-  // FX1E: Adds VX to I
-  initialize();
-  I = 23; V[5] = 149;
-  runOpcode(0xF51E);
-  assert(I = 23 + 149);
-
-  // FX29: Sets I to the location of the sprite for the character in VX.
-  // Characters 0-F (in hexadecimal) are represented by a 4x5 font
-  initialize();
-  V[7] = 8;
-  runOpcode(0xF729);
-  assert(I == 40);
-
-  // FX33: Stores the Binary-coded decimal representation of VX
-  initialize();
-  I = 0x300;
-  V[5] = 209;
-  runOpcode(0xF533);
-  assert(memory[I] == 2);
-  assert(memory[I + 1] == 0);
-  assert(memory[I + 2] == 9);
-
-  // FX55: Stores V0 to VX (including VX) in memory starting at address I
-  initialize();
-  I = 0x300;
-  V[0] = 0xAB; V[4] = 0xCB; V[5] = 0xDB;
-  runOpcode(0xF455);
-  assert(memory[I] == 0xAB);
-  assert(memory[I + 4] == 0xCB);
-  assert(memory[I + 5] == 0);
-
-  // FX65: Fills V0 to VX (including VX) with values from memory starting
-  // at address I
-  initialize();
-  I = 0x300;
-  memory[I + 0] = 0xAB; memory[I + 4] = 0xCB; memory[I + 5] = 0xDB;
-  runOpcode(0xF465);
-  assert(V[0] == 0xAB);
-  assert(V[4] == 0xCB);
-  assert(V[5] == 0);
-
-  printf("Completed successfully\n\n");
-};
@@ -1,32 +1,108 @@
 #ifndef CPU_H
 #define CPU_H
 
-#include "gpu.h"
-#include <SDL2/SDL.h>      // SDL2
+#include "io.h"
+#include "quirks.h"
+#include "stats.h"
+#include <memory>       // unique_ptr
+#include <stdint.h>     // uint32_t, uint64_t
 #include <string>
+#include <vector>
 using namespace std;
 
+class Chip8;
+class Jit;
+class Profiler;
+
+// A predecoded instruction: the handler that runs it plus its operands, pulled
+// out of the opcode ahead of time (see predecode.cpp)
+struct Instruction
+{
+  void (*handler)(Chip8 & chip8, const Instruction & in);
+  unsigned short opcode;
+  unsigned short nnn;
+  unsigned char x, y, n, nn;
+};
+
+// Ways of running instructions; all of them behave identically
+enum Engine
+{
+  ENGINE_INTERPRETER, // fetches and decodes every instruction (emulateCycle)
+  ENGINE_CACHED,      // runs predecoded instructions (predecode.cpp)
+  ENGINE_JIT          // recompiles to native code where it can (jit.cpp)
+};
+
+// What, if anything, the program is waiting for (see Chip8::waitState)
+enum WaitState
+{
+  WAIT_NONE,    // running normally
+  WAIT_TIMER,   // nothing will change until the timers next tick
+  WAIT_KEY,     // nothing will change until a key is pressed
+  WAIT_FOREVER  // stopped in a jump to itself, with the timers stopped
+};
+
+// Why the machine stopped a program that couldn't go on (see Chip8::fault)
+enum Fault
+{
+  FAULT_NONE,
+  FAULT_STACK_OVERFLOW,   // 2NNN with all 16 stack entries in use
+  FAULT_STACK_UNDERFLOW,  // 00EE with nothing on the stack
+  FAULT_PC_OUT_OF_RANGE,  // pc went past 0xFFF, where code can't run
+  FAULTS                  // number of kinds of fault
+};
+
+// "stack overflow" etc.
+const char * faultName(Fault fault);
+
 class Chip8
 {
 private:
   // 2 byte opcode
   unsigned short opcode;
 
-  /* 4k memory
+  /* 64k memory (XO-CHIP; chip8 programs only use the first 4k)
   0x000-0x1FF - Chip 8 interpreter (contains font set in emu)
-  0x050-0x0A0 - Used for the built in 4x5 pixel font set (0-F)
-  0x200-0xFFF - Program ROM and work RAM */
-  unsigned char memory[4096];
+  0x000-0x04F - Used for the built in 4x5 pixel font set (0-F)
+  0x050-0x0EF - Used for the SUPER-CHIP 8x10 pixel font set (0-F)
+  0x200-0xFFF - Program ROM and work RAM
+  0x1000-0xFFFF - More ROM and work RAM (XO-CHIP) */
+  unsigned char memory[65536];
 
   // 8 bit registers (16th is carry)
   unsigned char V[16];
 
-  // index register and program counter (both 0x000 - 0xFFF)
+  // index register (0x0000 - 0xFFFF) and program counter
   unsigned short I;
   unsigned short pc;
 
-  // 64 x 32 black and white display
-  unsigned char gfx[64 * 32];
+  // Up to 128 x 64 pixels in two bit-planes (XO-CHIP), two 64 bit words per
+  // row with the leftmost pixel in the most significant bit of the first.
+  // In low-res mode (64 x 32) only the first word of the first 32 rows is
+  // used. Plain chip8 programs only ever draw to plane 0
+  uint64_t gfx[2][64][2];
+  bool hires;
+  // planes that drawing, clearing and scrolling apply to (bit p for plane p)
+  unsigned char planes;
+
+  // bit y is set when row y may have changed since the last getFrame(), and
+  // the number of times the screen has been drawn to
+  uint64_t dirtyRows;
+  uint32_t frameSequence;
+
+  // SUPER-CHIP "RPL" flags (FX75/FX85), XO-CHIP audio pattern (F002) and
+  // pitch (FX3A), and whether the program has stopped, either by exiting
+  // (00FD) or on a fault
+  unsigned char rpl[16];
+  unsigned char audioPattern[16];
+  unsigned char pitch;
+  bool exited;
+  Fault faulted;
+  // Stops the program where it is; returns false, to end step()
+  bool stop(Fault reason){
+    faulted = reason;
+    exited = true;
+    return false;
+  }
 
   // interrupts - when set above zero, count to zero
   unsigned char delay_timer;
@@ -36,26 +112,174 @@ private:
   unsigned short stack[16];
   unsigned short sp;
 
-  // hex-based keypad
-  unsigned char keypad[16];
+  // hex-based keypad, bit i set while key i is held
+  uint16_t keypad;
+  bool keyHeld(unsigned char key) { return key < 16 && ((keypad >> key) & 1); }
+
+  // Skips the instruction after this one, which is 4 bytes long if it's an
+  // XO-CHIP F000 NNNN (only in profiles that have it)
+  template <QuirkProfile P>
+  void skipNext(){
+    pc += quirksOf(P).longLoad && memory[(pc + 2) & 0xFFFF] == 0xF0 &&
+      memory[(pc + 3) & 0xFFFF] == 0 ? 6 : 4;
+  }
+
+  // per-machine xorshift64* generator for CXNN, restarted from rngSeed by
+  // initialize() so the same seed and input always give the same run
+  uint64_t rngSeed;
+  uint64_t rngState;
+  unsigned char nextRandom();
+  void restartRandom();
+
+  // where the sound timer's tone goes (may be NULL), and whether it's playing
+  AudioSink * audio;
+  bool toneOn;
+  void setTone(bool on);
+  // passes audioPattern and pitch on to audio, after they change
+  void setPattern();
+
+  // instructions at 0x200-0xFFE, decoded the first time they're run and
+  // thrown away again when the program writes over them
+  Instruction decoded[0xFFF - 0x200];
+  Engine engine;
+  // what invalidated instructions are reset to (the decoder for the profile)
+  void (*decoder)(Chip8 & chip8, const Instruction & in);
+  void selectDecoder();
+  void invalidate(unsigned short address, unsigned short length);
+  // 256 byte pages of memory written since the snapshot was taken (every
+  // write goes through invalidate()), bit p % 64 of word p / 64 for page p
+  uint64_t writtenPages[4];
+  // what restoreSnapshot() goes back to: a save state, plus its screen as
+  // laid out in gfx, which is quicker to copy back than to decode
+  vector<unsigned char> snapshot;
+  uint64_t snapshotScreen[2][64][2];
+  // reads everything in a save state after memory and the screen (see
+  // savestate.cpp)
+  void loadRegisters(const unsigned char * in);
+  unsigned int runCached(unsigned int cycles);
+  friend struct Ops;
+
+  // only created once the JIT engine is selected
+  unique_ptr<Jit> jit;
+  unsigned int runJit(unsigned int cycles);
+  friend class Jit;
 
-  // testing function
+  uint64_t romDigest;
+  void romLoaded(size_t size);
+
+  // the quirk profile, and the interpreter compiled for it (the counting
+  // one while stats are attached)
+  QuirkProfile quirks;
+  unsigned int (Chip8::*interpreter)(unsigned int cycles);
+  void selectInterpreter();
+  template <QuirkProfile P, bool counting>
+  unsigned int interpret(unsigned int cycles);
+  template <QuirkProfile P, bool counting> bool step();
+
+  // where counts go while they're being kept (may be NULL), and the frame
+  // sequence as of the end of the last frame counted
+  Stats * stats;
+  uint32_t countedSequence;
+
+  // samples the call stack between batches (may be NULL)
+  Profiler * profiler;
+  friend class Profiler;
+
+  // skipping programs that are waiting for the delay timer, a key or nothing
+  unsigned int runBatch(unsigned int cycles);
+  unsigned int runEngine(unsigned int cycles);
+  bool waitLoop(unsigned short address);
+  unsigned int skipWait(unsigned int cycles);
+  bool halted();
+  bool awaitingKey();
+
+  // counting adds the draw to stats, and is only set by the counting
+  // interpreter, so the others don't check for stats at all
+  template <QuirkProfile P, bool counting = false>
+  void drawSprite(unsigned char x, unsigned char y, unsigned char height);
+  void clearScreen();
+  void setResolution(bool high);
+  void scrollDown(int rows);
+  void scrollRight(int pixels);
+
+  // testing functions (selftest.cpp)
   void runOpcode(unsigned short op);
+  void runSelfTests();
 
-  // debug function
+  // debug function, which prints unless warnings are off
   void unknownOpcode();
+  bool warnings;
  
 public:
+  // set by 00E0/DXYN, cleared once the frame has been handed out by getFrame
   bool drawFlag;
 
+  Chip8();
+  ~Chip8();
+
   void initialize();
   bool emulateCycle();
-  void render(Gpu gpu);
-  void loadGame(string name);
-  void setKeys();
+  unsigned int run(unsigned int cycles);
+  // checked between batches, so the front end can sleep instead of running
+  // frames that can't change anything
+  WaitState waitState();
+  void setEngine(Engine e);
+  // Which interpreter's behaviour to follow where they disagree (quirks.h).
+  // Kept by initialize(), like the engine
+  void setQuirks(QuirkProfile profile);
+  QuirkProfile quirkProfile();
+  void tickTimers();
+  FrameView getFrame();
+  uint64_t screenHash();
+  // Loads a rom at 0x200 from a file or a buffer. Prints an error and returns
+  // false if it can't be read or doesn't fit. Code can't run past 0xFFF in
+  // any profile, but XO-CHIP programs can keep data there, so only they can
+  // be bigger than 0xE00 bytes (see romSizeLimit, which depends on the quirk
+  // profile)
+  static const unsigned int maxRomSize = 65536 - 0x200;
+  unsigned int romSizeLimit();
+  bool loadGame(const string & name);
+  bool loadGame(const unsigned char * data, size_t size);
+  // hash of the rom last loaded, e.g. for caching results by rom
+  uint64_t romHash();
+  void setKeys(InputSource & input);
+  void attachAudio(AudioSink * sink);
+  // Whether unknown opcodes are printed as they're run (they are unless
+  // turned off, e.g. for running random programs)
+  void setWarnings(bool on);
+  // Counts what the program does into stats until detached with NULL (see
+  // stats.h). Counting runs on the interpreter, whatever the engine
+  void attachStats(Stats * stats);
+  // Samples the call stack into profiler until detached with NULL (see
+  // profiler.h). Batches are split at each sample point, which doesn't change
+  // what the program does, so any engine can be used
+  void attachProfiler(Profiler * profiler);
+  // also restarts the generator; initialize() keeps the seed
+  void seed(uint64_t value);
+  // snapshot of the whole machine as a versioned blob (see savestate.cpp);
+  // loadState leaves the machine alone and returns false if the blob is bad
+  // or was saved under another quirk profile
+  void saveState(vector<unsigned char> & state);
+  bool loadState(const vector<unsigned char> & state);
+  // Keeps a copy of the machine to go back to with restoreSnapshot(). Going
+  // back only copies the memory written since, so for running lots of short
+  // programs it's much cheaper than initialize() and loadGame(). Restoring
+  // returns false if no snapshot has been taken
+  void takeSnapshot();
+  bool restoreSnapshot();
+  // Hash of the registers, stack, timers and other state, and of the memory
+  // written since the snapshot was taken, for checking that two machines
+  // started from the same snapshot ended up in the same place
+  uint64_t machineHash();
+  // Why the program was stopped, if it was stopped by a fault; pc is left on
+  // the instruction that faulted
+  Fault fault();
+  unsigned short faultAddress();
   void debugRender();
   void shutdown();
 
+  // Runs the opcode tests on every engine, asserting as it goes. Only the
+  // test binary (make test) links these in
   void selfTest();
 };
  
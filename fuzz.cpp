@@ -0,0 +1,295 @@
+#include "chip8.h"
+#include "scheduler.h"
+#include <chrono>
+#include <cstdlib>        // exit, strtoul, strtoull
+#include <cstring>        // strcmp
+#include <fstream>
+#include <iterator>       // istreambuf_iterator
+#include <memory>         // unique_ptr
+#include <stdint.h>       // uint8_t, uint16_t, uint64_t
+#include <stdio.h>        // printf
+#include <string>
+#include <vector>
+using namespace std;
+
+/* Runs random programs and key presses, looking for inputs that make the
+   core misbehave. Nothing here touches SDL.
+
+   An input is:
+
+     byte 0        the quirk profile (mod the number of profiles)
+     byte 1        the engine to check against the interpreter (mod 3)
+     byte 2        K, how many frames have keys given
+     2K bytes      the keys held in each of those frames (low byte first,
+                   bit i for key i); no keys are held after that
+     the rest      the rom, loaded at 0x200
+
+   Each input runs for a fixed number of frames on the interpreter and on the
+   other engine, which have to end up in the same place: the same screen,
+   registers, stack, timers and memory (see Chip8::machineHash). A program
+   that overflows or underflows the stack, or runs off the end of memory, is
+   stopped with a fault (see Chip8::fault), which is counted but is nothing
+   wrong with the core; a difference between the engines is.
+
+   Every machine is set up once and snapshotted, then restored between
+   inputs, which only has to undo what the last program wrote.
+
+   Built with -DLIBFUZZER this is just LLVMFuzzerTestOneInput, to be linked
+   with -fsanitize=fuzzer, and aborts on a mismatch. Otherwise it has its own
+   main, which runs random inputs, or the input files given, and reports what
+   they did */
+
+// Frames each input runs for, and instructions per frame
+static unsigned int frames = 8;
+static unsigned int frameCycles = 32;
+
+// Hands out the keys for each frame in turn
+class FuzzKeys : public InputSource
+{
+public:
+  FuzzKeys(const uint8_t * keys, size_t count)
+    : keys(keys), count(count), frame(0) {}
+
+  uint16_t readKeys(){
+    uint16_t held = frame < count ?
+      keys[2 * frame] | keys[2 * frame + 1] << 8 : 0;
+    frame++;
+    return held;
+  }
+
+private:
+  const uint8_t * keys;
+  size_t count;
+  size_t frame;
+};
+
+// How a run ended. The machine hash covers the registers, stack, timers and
+// every page of memory written, so engines that differ anywhere show up even
+// if it never reaches the screen
+struct Outcome
+{
+  unsigned long long cycles;
+  uint64_t screen;
+  uint64_t machine;
+  Fault fault;
+  unsigned short pc;
+
+  bool operator==(const Outcome & other) const {
+    return cycles == other.cycles && screen == other.screen &&
+      machine == other.machine && fault == other.fault && pc == other.pc;
+  }
+};
+
+// One snapshotted machine for each profile and engine, made when first used
+static unique_ptr<Chip8> machines[QUIRK_PROFILES][3];
+
+static Chip8 & machine(QuirkProfile quirks, Engine engine){
+  unique_ptr<Chip8> & chip8 = machines[quirks][engine];
+  if (!chip8){
+    chip8.reset(new Chip8());
+    chip8->setWarnings(false);
+    chip8->setEngine(engine);
+    chip8->setQuirks(quirks);
+    chip8->seed(0);
+    chip8->initialize();
+    chip8->takeSnapshot();
+  }
+  return *chip8;
+}
+
+static Outcome runInput(Chip8 & chip8, const uint8_t * keys, size_t keyFrames,
+    const uint8_t * rom, size_t romSize){
+  chip8.restoreSnapshot();
+  chip8.loadGame(rom, romSize);
+
+  FuzzKeys input(keys, keyFrames);
+  Scheduler scheduler(frameCycles * frameRate, (unsigned long long)frames *
+    frameCycles);
+  while (scheduler.runFrame(chip8, input))
+    ;
+
+  Outcome outcome = { scheduler.totalCycles, chip8.screenHash(),
+    chip8.machineHash(), chip8.fault(), chip8.faultAddress() };
+  return outcome;
+}
+
+// What an input did: the fault it stopped on (if any), and whether the
+// engines agreed
+struct Finding
+{
+  Fault fault;
+  unsigned short address;
+  bool mismatch;
+  Engine engine;
+};
+
+static Finding fuzzOne(const uint8_t * data, size_t size){
+  uint8_t header[3] = { 0, 0, 0 };
+  for (size_t i = 0; i < 3 && i < size; i++)
+    header[i] = data[i];
+  size_t used = size < 3 ? size : 3;
+  QuirkProfile quirks = (QuirkProfile)(header[0] % QUIRK_PROFILES);
+  Engine engine = (Engine)(header[1] % 3);
+
+  size_t keyFrames = header[2];
+  if (2 * keyFrames > size - used)
+    keyFrames = (size - used) / 2;
+  const uint8_t * keys = data + used;
+  used += 2 * keyFrames;
+
+  Chip8 & interpreter = machine(quirks, ENGINE_INTERPRETER);
+  const uint8_t * rom = data + used;
+  size_t romSize = size - used;
+  if (romSize > interpreter.romSizeLimit())
+    romSize = interpreter.romSizeLimit();
+
+  Outcome expected = runInput(interpreter, keys, keyFrames, rom, romSize);
+  Finding finding = { expected.fault, expected.pc, false, engine };
+  if (engine != ENGINE_INTERPRETER){
+    Outcome actual = runInput(machine(quirks, engine), keys, keyFrames, rom,
+      romSize);
+    finding.mismatch = !(actual == expected);
+  }
+  return finding;
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t * data, size_t size){
+  if (fuzzOne(data, size).mismatch)
+    abort();
+  return 0;
+}
+
+#ifndef LIBFUZZER
+
+static const char * const engineNames[] = { "interpreter", "cached", "jit" };
+
+// Random inputs: a header, a few frames of keys and up to 512 bytes of rom
+static vector<uint8_t> randomInput(uint64_t & state){
+  vector<uint8_t> input;
+  state ^= state >> 12;
+  state ^= state << 25;
+  state ^= state >> 27;
+  uint64_t r = state * 0x2545F4914F6CDD1DULL;
+  size_t size = 3 + (r >> 32) % 540;
+  for (size_t i = 0; i < size; i += 8){
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    r = state * 0x2545F4914F6CDD1DULL;
+    for (size_t b = 0; b < 8 && i + b < size; b++)
+      input.push_back(r >> (8 * b));
+  }
+  input[2] %= 8;
+  return input;
+}
+
+static bool saveInput(const vector<uint8_t> & input, const string & path){
+  ofstream file(path, ios::out|ios::binary|ios::trunc);
+  file.write((const char *)input.data(), input.size());
+  if (!file.good()){
+    printf("Could not write input '%s'\n", path.c_str());
+    return false;
+  }
+  return true;
+}
+
+void usage(){
+  printf("Usage: ./chip8-fuzz [options] [input files]\n");
+  printf("  --runs N        random inputs to try (default 100000)\n");
+  printf("  --seed N        seed for generating them (default 0)\n");
+  printf("  --frames N      frames each input runs for (default 8)\n");
+  printf("  --frame-cycles N  instructions per frame (default 32)\n");
+  printf("  --save DIR      write inputs that fault or mismatch to DIR\n");
+  printf("  With input files, runs just those and says what each did\n");
+}
+
+int main(int argc, char **argv)
+{
+  unsigned long long runs = 100000;
+  uint64_t seed = 0;
+  const char * saveDir = NULL;
+  vector<const char *> files;
+
+  for (int i = 1; i < argc; i++){
+    if (strcmp(argv[i], "--runs") == 0 && i + 1 < argc){
+      runs = strtoull(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc){
+      seed = strtoull(argv[++i], NULL, 0);
+    } else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc){
+      frames = strtoul(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--frame-cycles") == 0 && i + 1 < argc){
+      frameCycles = strtoul(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--save") == 0 && i + 1 < argc){
+      saveDir = argv[++i];
+    } else if (argv[i][0] != '-'){
+      files.push_back(argv[i]);
+    } else {
+      usage();
+      exit(0);
+    }
+  }
+  if (frames == 0 || frameCycles == 0){
+    printf("Incorrect arguments. ");
+    usage();
+    exit(0);
+  }
+
+  // Replaying inputs, e.g. ones saved earlier
+  if (!files.empty()){
+    int mismatches = 0;
+    for (size_t f = 0; f < files.size(); f++){
+      ifstream file(files[f], ios::in|ios::binary);
+      if (!file.is_open()){
+        printf("Could not open input '%s'\n", files[f]);
+        return 1;
+      }
+      vector<uint8_t> input((istreambuf_iterator<char>(file)),
+        istreambuf_iterator<char>());
+      Finding finding = fuzzOne(input.data(), input.size());
+      printf("%s: %s at 0x%03X%s%s\n", files[f], faultName(finding.fault),
+        finding.address, finding.mismatch ? ", MISMATCH with " : "",
+        finding.mismatch ? engineNames[finding.engine] : "");
+      mismatches += finding.mismatch;
+    }
+    return mismatches == 0 ? 0 : 1;
+  }
+
+  unsigned long long faults[FAULTS] = { 0 };
+  unsigned long long mismatches = 0;
+  uint64_t state = seed * 0x9E3779B97F4A7C15ULL + 1;
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  for (unsigned long long run = 0; run < runs; run++){
+    vector<uint8_t> input = randomInput(state);
+    Finding finding = fuzzOne(input.data(), input.size());
+    faults[finding.fault]++;
+    mismatches += finding.mismatch;
+
+    // Keeps the first of each kind
+    bool first = (finding.fault != FAULT_NONE && faults[finding.fault] == 1) ||
+      (finding.mismatch && mismatches == 1);
+    if (finding.mismatch || first){
+      string name = finding.mismatch ? string("mismatch-") +
+        engineNames[finding.engine] : faultName(finding.fault);
+      for (size_t c = 0; c < name.size(); c++){
+        if (name[c] == ' ')
+          name[c] = '-';
+      }
+      name += "-" + to_string(run);
+      printf("run %llu: %s at 0x%03X%s%s\n", run, faultName(finding.fault),
+        finding.address, finding.mismatch ? ", MISMATCH with " : "",
+        finding.mismatch ? engineNames[finding.engine] : "");
+      if (saveDir != NULL)
+        saveInput(input, string(saveDir) + "/" + name + ".bin");
+    }
+  }
+  double seconds = chrono::duration<double>(
+    chrono::steady_clock::now() - start).count();
+
+  printf("%llu runs in %.2fs (%.0f/s)\n", runs, seconds, runs / seconds);
+  for (int f = 0; f < FAULTS; f++)
+    printf("  %-16s %llu\n", faultName((Fault)f), faults[f]);
+  printf("  %-16s %llu\n", "engine mismatch", mismatches);
+  return mismatches == 0 ? 0 : 1;
+}
+
+#endif
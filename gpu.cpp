@@ -1,10 +1,67 @@
 #include "gpu.h"
+#include "pixels.h"
 #include <SDL2/SDL.h>        // SDL2
-#include <stdlib.h>     // srand, rand
+#include <string.h>     // memcpy, memset
+#include <utility>      // move
 
-bool Gpu::initialize(){
+// Shown until the core hands over its first frame
+static const uint64_t blank[2][128] = { { 0 } };
+
+Gpu::Gpu(){
+  current.planes[0] = blank[0];
+  current.planes[1] = blank[1];
+  current.width = 64;
+  current.height = 32;
+  current.dirtyRows = 0;
+  current.sequence = 0;
+  memset(previous, 0, sizeof(previous));
+  memset(shown, 0, sizeof(shown));
+};
+
+Gpu::Gpu(Gpu && other){
+  current.planes[0] = blank[0];
+  current.planes[1] = blank[1];
+  *this = std::move(other);
+};
+
+Gpu & Gpu::operator=(Gpu && other){
+  if (this == &other)
+    return *this;
+  shutdown();
+
+  // Take over the other Gpu's SDL resources; it's left owning nothing
+  window = other.window;
+  renderer = other.renderer;
+  renderTexture = other.renderTexture;
+  sdlStarted = other.sdlStarted;
+  other.window = NULL;
+  other.renderer = NULL;
+  other.renderTexture = NULL;
+  other.sdlStarted = false;
+
+  current = other.current;
+  memcpy(previous, other.previous, sizeof(previous));
+  memcpy(shown, other.shown, sizeof(shown));
+  shownWidth = other.shownWidth;
+  shownHeight = other.shownHeight;
+  frameRows = other.frameRows;
+  previousRows = other.previousRows;
+  pendingRows = other.pendingRows;
+  mode = other.mode;
+  refreshTicks = other.refreshTicks;
+  lastPresent = other.lastPresent;
+  presented = other.presented;
+  return *this;
+};
+
+Gpu::~Gpu(){
+  shutdown();
+};
+
+bool Gpu::initialize(PresentMode presentMode){
   // Initialization flag
   bool success = true;
+  mode = presentMode;
 
   // Initialize SDL
   if(SDL_Init(SDL_INIT_VIDEO) < 0)
@@ -14,6 +71,8 @@ bool Gpu::initialize(){
   }
   else
   {
+    sdlStarted = true;
+
     // Create window
     window = SDL_CreateWindow("Chip 8 Emulator", SDL_WINDOWPOS_UNDEFINED,
       SDL_WINDOWPOS_UNDEFINED, 64 * scale, 32 * scale,
@@ -26,44 +85,165 @@ bool Gpu::initialize(){
     else
     {
       // Get window renderer
-      renderer = SDL_CreateRenderer(window, -1, 0);
-      pixels = new Uint32[64 * 32];
+      renderer = SDL_CreateRenderer(window, -1,
+        mode == PRESENT_VSYNC ? SDL_RENDERER_PRESENTVSYNC : 0);
       renderTexture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
-        SDL_TEXTUREACCESS_STATIC, 64, 32);
+        SDL_TEXTUREACCESS_STREAMING, 128, 64);
+
+      // Present no more often than the display can show frames
+      SDL_DisplayMode display;
+      int refreshRate = 60;
+      if (SDL_GetCurrentDisplayMode(SDL_GetWindowDisplayIndex(window),
+          &display) == 0 && display.refresh_rate > 0)
+        refreshRate = display.refresh_rate;
+      refreshTicks = SDL_GetPerformanceFrequency() / refreshRate;
+      lastPresent = SDL_GetPerformanceCounter();
+
+      // Start with a blank screen
+      upload(blank, 0, shownHeight - 1);
+      SDL_Rect source = { 0, 0, (int)shownWidth, (int)shownHeight };
+      SDL_RenderClear(renderer);
+      SDL_RenderCopy(renderer, renderTexture, &source, NULL);
+      SDL_RenderPresent(renderer);
     }
   }
 
   return success;
 };
 
-void Gpu::render(unsigned char * gfx){
-  memset(pixels, 255, 64 * 32 * sizeof(Uint32));
+// Converts rows first to last (inclusive), shownWidth pixels across, to ARGB
+// and streams them into the top left of the texture. Locked texture memory
+// is write-only, so every row in the range is written even if only some of
+// them changed
+void Gpu::upload(const uint64_t (*planes)[128], unsigned int first,
+    unsigned int last){
+  SDL_Rect rect = { 0, (int)first, (int)shownWidth, (int)(last - first + 1) };
+  void * locked;
+  int pitch;
+  if (SDL_LockTexture(renderTexture, &rect, &locked, &pitch) < 0)
+    return;
 
-  for(unsigned int i = 0; i < 64 * 32; i++){
-    if(gfx[i] == 1)
-      pixels[i] = 0;
+  const uint64_t * rows[2] = { planes[0], planes[1] };
+  framePixels(rows, shownWidth, first, last, (uint32_t *)locked, pitch);
+  for(unsigned int y = first; y <= last; y++){
+    for(unsigned int p = 0; p < 2; p++){
+      shown[p][2 * y] = planes[p][2 * y];
+      shown[p][2 * y + 1] = planes[p][2 * y + 1];
+    }
   }
 
-  SDL_UpdateTexture(renderTexture, NULL, pixels, 64 * sizeof(Uint32));
+  SDL_UnlockTexture(renderTexture);
+};
+
+void Gpu::render(const FrameView & frame){
+  // Just keep the view; present() decides when it reaches the screen
+  current = frame;
+  frameRows |= frame.dirtyRows;
+};
+
+// Brings previous up to date with the current frame, which only differs in
+// the rows it changed (all of them after a change of resolution)
+void Gpu::remember(bool resized){
+  uint64_t rows = resized ? ~0ULL : frameRows;
+  for(unsigned int y = 0; y < 64; y++){
+    if ((rows >> y & 1) == 0)
+      continue;
+    for(unsigned int p = 0; p < 2; p++){
+      previous[p][2 * y] = current.planes[p][2 * y];
+      previous[p][2 * y + 1] = current.planes[p][2 * y + 1];
+    }
+  }
+  previousRows = frameRows;
+  frameRows = 0;
+};
+
+void Gpu::present(){
+  // Blending across a change of resolution would mix up two layouts
+  bool resized = current.width != shownWidth || current.height != shownHeight;
+  bool blend = mode == PRESENT_BLEND && !resized;
+
+  // A row can only look different if this frame changed it or, blending,
+  // the frame before did
+  pendingRows |= frameRows | (blend ? previousRows : 0);
+
+  Uint64 now = SDL_GetPerformanceCounter();
+  if (mode != PRESENT_VSYNC){
+    // Frames that come in faster than the display refreshes are dropped (the
+    // next one supersedes them). A little slack stops a loop running at the
+    // refresh rate from missing every other refresh due to timer jitter
+    if (now - lastPresent < refreshTicks - refreshTicks / 8){
+      remember(resized);
+      return;
+    }
+  }
+
+  // Work out the candidate rows as they'll be shown, then find the ones that
+  // really differ from the texture (all of them after a change of resolution)
+  uint64_t rows = resized ? ~0ULL : pendingRows;
+  uint64_t display[2][128];
+  uint64_t changed = 0;
+  for(unsigned int y = 0; y < current.height; y++){
+    if ((rows >> y & 1) == 0)
+      continue;
+    for(unsigned int p = 0; p < 2; p++){
+      display[p][2 * y] = current.planes[p][2 * y];
+      display[p][2 * y + 1] = current.planes[p][2 * y + 1];
+      if (blend){
+        display[p][2 * y] |= previous[p][2 * y];
+        display[p][2 * y + 1] |= previous[p][2 * y + 1];
+      }
+      if (resized || display[p][2 * y] != shown[p][2 * y] ||
+          display[p][2 * y + 1] != shown[p][2 * y + 1])
+        changed |= 1ULL << y;
+    }
+  }
+  remember(resized);
+  pendingRows = 0;
+
+  // Nothing on screen would change, so there's nothing to present
+  if (mode != PRESENT_VSYNC && changed == 0)
+    return;
+  lastPresent = now;
+
+  // Upload each run of changed rows
+  shownWidth = current.width;
+  shownHeight = current.height;
+  for(unsigned int y = 0; y < shownHeight; y++){
+    if ((changed >> y & 1) == 0)
+      continue;
+    unsigned int last = y;
+    while (last + 1 < shownHeight && (changed >> (last + 1) & 1))
+      last++;
+    upload(display, y, last);
+    y = last;
+  }
+
+  // In vsync mode this blocks until the next refresh even if nothing changed,
+  // which is what paces the emulator
+  SDL_Rect source = { 0, 0, (int)shownWidth, (int)shownHeight };
   SDL_RenderClear(renderer);
-  SDL_RenderCopy(renderer, renderTexture, NULL, NULL);
+  SDL_RenderCopy(renderer, renderTexture, &source, NULL);
   SDL_RenderPresent(renderer);
+  presented++;
 };
 
 void Gpu::shutdown(){
-  delete[] pixels;
-
-  //Deallocate surface
-  SDL_DestroyTexture(renderTexture);
+  //Deallocate texture
+  if (renderTexture != NULL)
+    SDL_DestroyTexture(renderTexture);
   renderTexture = NULL;
 
+  if (renderer != NULL)
+    SDL_DestroyRenderer(renderer);
+  renderer = NULL;
+
   //Destroy window
-  SDL_DestroyWindow(window);
+  if (window != NULL)
+    SDL_DestroyWindow(window);
   window = NULL;
 
-  SDL_DestroyRenderer(renderer);
-  renderer = NULL;
-
   //Quit SDL subsystems
-  SDL_Quit();
+  if (sdlStarted)
+    SDL_Quit();
+  sdlStarted = false;
 };
@@ -1,9 +1,21 @@
 #ifndef GPU_H
 #define GPU_H
 
+#include "io.h"
 #include <SDL2/SDL.h>      // SDL2
 
-class Gpu
+// When frames get to the screen
+enum PresentMode
+{
+  PRESENT_LATEST, // the latest frame, at most once per display refresh
+  PRESENT_BLEND,  // the latest two frames ORed together (less flicker), at
+                  // most once per display refresh
+  PRESENT_VSYNC   // every frame, waiting for vsync (which paces emulation)
+};
+
+// Owns the SDL window, renderer and texture (and SDL itself), releasing them
+// when destroyed. Can be moved but not copied, so there's only ever one owner
+class Gpu : public VideoSink
 {
 private:
   SDL_Window* window = NULL;
@@ -12,12 +24,47 @@ private:
 
   SDL_Texture* renderTexture = NULL;
 
-  Uint32 * pixels = NULL;
+  bool sdlStarted = false;
+
+  // the core's latest frame (a view, not a copy), the frame as of the
+  // previous present() for blending, and what the texture currently shows
+  // (both planes, laid out as in FrameView, and the resolution)
+  FrameView current;
+  uint64_t previous[2][128];
+  uint64_t shown[2][128];
+  unsigned int shownWidth = 64;
+  unsigned int shownHeight = 32;
+  // rows the frames handed to render() changed since the last present(),
+  // the rows the frame before changed (which blending shows too), and rows
+  // that may differ from what's shown but haven't been uploaded yet
+  uint64_t frameRows = 0;
+  uint64_t previousRows = 0;
+  uint64_t pendingRows = 0;
+
+  PresentMode mode = PRESENT_LATEST;
+  Uint64 refreshTicks = 0;
+  Uint64 lastPresent = 0;
+  // frames that actually reached the screen
+  unsigned long long presented = 0;
+
+  void upload(const uint64_t (*planes)[128], unsigned int first,
+    unsigned int last);
+  void remember(bool resized);
  
 public:
-	const unsigned char scale = 10;
-  bool initialize();
-  void render(unsigned char * gfx);
+  static const unsigned char scale = 10;
+
+  Gpu();
+  Gpu(Gpu && other);
+  Gpu & operator=(Gpu && other);
+  Gpu(const Gpu &) = delete;
+  Gpu & operator=(const Gpu &) = delete;
+  ~Gpu();
+
+  bool initialize(PresentMode presentMode);
+  void render(const FrameView & frame);
+  void present();
+  unsigned long long presentedFrames() const { return presented; }
   void shutdown();
 };
  
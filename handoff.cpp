@@ -0,0 +1,58 @@
+#include "handoff.h"
+#include <string.h>     // memcpy, memset
+
+TripleBuffer::TripleBuffer() : middle(1), back(0), front(2), lastRows(0),
+    lastPublished(0), lastButOneTaken(true){
+  memset(slots, 0, sizeof(slots));
+};
+
+void TripleBuffer::publish(const FrameView & frame){
+  Slot & slot = slots[back];
+  memcpy(slot.planes[0], frame.planes[0], sizeof(slot.planes[0]));
+  memcpy(slot.planes[1], frame.planes[1], sizeof(slot.planes[1]));
+  slot.width = frame.width;
+  slot.height = frame.height;
+  slot.sequence = frame.sequence;
+
+  // If the frame before last was taken, the reader has at least that one,
+  // so this frame's rows and the last one's cover it. If not, it may have
+  // been dropped, and the last frame's rows as published already cover it
+  slot.dirtyRows = frame.dirtyRows |
+    (lastButOneTaken ? lastRows : lastPublished);
+  lastRows = frame.dirtyRows;
+  lastPublished = slot.dirtyRows;
+
+  // Release so the reader sees the planes once it sees the slot
+  unsigned char replaced = middle.exchange(back | freshBit,
+    std::memory_order_acq_rel);
+  lastButOneTaken = (replaced & freshBit) == 0;
+  back = replaced & ~freshBit;
+};
+
+bool TripleBuffer::consume(FrameView & frame){
+  if ((middle.load(std::memory_order_relaxed) & freshBit) == 0)
+    return false;
+
+  front = middle.exchange(front, std::memory_order_acq_rel) & ~freshBit;
+
+  const Slot & slot = slots[front];
+  frame.planes[0] = slot.planes[0];
+  frame.planes[1] = slot.planes[1];
+  frame.width = slot.width;
+  frame.height = slot.height;
+  // covers any frames in between that were dropped (see publish)
+  frame.dirtyRows = slot.dirtyRows;
+  frame.sequence = slot.sequence;
+  return true;
+};
+
+SharedKeypad::SharedKeypad() : bits(0){
+};
+
+void SharedKeypad::set(uint16_t keys){
+  bits.store(keys, std::memory_order_relaxed);
+};
+
+uint16_t SharedKeypad::readKeys(){
+  return bits.load(std::memory_order_relaxed);
+};
@@ -0,0 +1,71 @@
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+#include "io.h"
+#include <atomic>
+#include <stdint.h>     // uint16_t, uint32_t, uint64_t
+
+/* Lock-free handoff between an emulation thread and the front end thread */
+
+// Passes completed frames from one writer thread to one reader thread. There
+// are three slots: the writer fills the back one, the reader shows the front
+// one and the middle one holds the newest finished frame. Publishing and
+// consuming just swap a slot with the middle, so neither side ever waits for
+// the other, and the reader always gets the latest frame (older ones that it
+// didn't get to in time are dropped)
+class TripleBuffer
+{
+public:
+  TripleBuffer();
+
+  // Writer: copy the frame in and make it the latest one
+  void publish(const FrameView & frame);
+
+  // Reader: if a frame has been published since the last call, point frame at
+  // it and return true. The planes stay valid until the next consume()
+  bool consume(FrameView & frame);
+
+private:
+  struct Slot
+  {
+    uint64_t planes[2][128];
+    unsigned int width;
+    unsigned int height;
+    uint64_t dirtyRows;
+    uint32_t sequence;
+  };
+  Slot slots[3];
+
+  // index of the middle slot, plus freshBit if it hasn't been consumed yet
+  std::atomic<unsigned char> middle;
+  static const unsigned char freshBit = 0x4;
+
+  // only touched by the writer and reader respectively
+  unsigned char back;
+  unsigned char front;
+
+  // The reader may drop frames, so each published frame's rows have to
+  // cover every frame since the last one the reader might have taken. The
+  // writer only learns a frame was dropped when it publishes the next one,
+  // so it keeps the previous frame's own rows, the rows it was published
+  // with, and whether the frame before it was taken
+  uint64_t lastRows;
+  uint64_t lastPublished;
+  bool lastButOneTaken;
+};
+
+// Keypad state written by the front end and read by the emulation thread, as
+// a 16 bit mask (bit i set if key i is held)
+class SharedKeypad : public InputSource
+{
+public:
+  SharedKeypad();
+
+  void set(uint16_t keys);
+  uint16_t readKeys();
+
+private:
+  std::atomic<uint16_t> bits;
+};
+
+#endif
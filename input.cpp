@@ -0,0 +1,180 @@
+#include "input.h"
+#include <SDL2/SDL.h>   // SDL2
+#include <fstream>
+#include <sstream>
+#include <stdio.h>      // printf
+
+/* Default keymapping:
+
+Keypad                 Keyboard
+1|2|3|C       -->      1|2|3|4
+4|5|6|D       -->      Q|W|E|R
+7|8|9|E       -->      A|S|D|F
+A|0|B|F       -->      Z|X|C|V
+
+and on a game controller, the d-pad is 2/4/6/8 (up/left/right/down), A is 5,
+B is 6, X is 4, Y is 0 and start is F.
+
+A keymap file replaces all of this. Each line is a keypad key in hex followed
+by either an SDL key name, or "pad" and an SDL controller button name, and
+anything after a '#' is a comment, e.g.
+
+  5 Space
+  5 pad a
+  2 Up
+  2 pad dpup
+
+(key names: https://wiki.libsdl.org/SDL_Scancode, button names:
+https://wiki.libsdl.org/SDL_GameControllerGetStringForButton) */
+
+static const SDL_Scancode defaultKeys[16] =
+{
+  SDL_SCANCODE_X, SDL_SCANCODE_1, SDL_SCANCODE_2, SDL_SCANCODE_3, // 0-3
+  SDL_SCANCODE_Q, SDL_SCANCODE_W, SDL_SCANCODE_E, SDL_SCANCODE_A, // 4-7
+  SDL_SCANCODE_S, SDL_SCANCODE_D, SDL_SCANCODE_Z, SDL_SCANCODE_C, // 8-B
+  SDL_SCANCODE_4, SDL_SCANCODE_R, SDL_SCANCODE_F, SDL_SCANCODE_V  // C-F
+};
+
+Controls::Controls(){
+  for (unsigned char i = 0; i < 16; i++)
+    keys[defaultKeys[i]] = i;
+
+  buttons[SDL_CONTROLLER_BUTTON_DPAD_UP] = 0x2;
+  buttons[SDL_CONTROLLER_BUTTON_DPAD_LEFT] = 0x4;
+  buttons[SDL_CONTROLLER_BUTTON_DPAD_RIGHT] = 0x6;
+  buttons[SDL_CONTROLLER_BUTTON_DPAD_DOWN] = 0x8;
+  buttons[SDL_CONTROLLER_BUTTON_A] = 0x5;
+  buttons[SDL_CONTROLLER_BUTTON_B] = 0x6;
+  buttons[SDL_CONTROLLER_BUTTON_X] = 0x4;
+  buttons[SDL_CONTROLLER_BUTTON_Y] = 0x0;
+  buttons[SDL_CONTROLLER_BUTTON_START] = 0xF;
+};
+
+Controls::~Controls(){
+  shutdown();
+};
+
+bool Controls::initialize(){
+  // Controllers already plugged in show up as added events once this is on
+  if (SDL_InitSubSystem(SDL_INIT_GAMECONTROLLER) < 0){
+    printf("SDL game controllers could not initialize! SDL_Error: %s\n",
+      SDL_GetError());
+    return false;
+  }
+  padsStarted = true;
+  return true;
+};
+
+bool Controls::loadKeymap(const std::string & path){
+  std::ifstream file(path);
+  if (!file.is_open()){
+    printf("Could not open keymap '%s'\n", path.c_str());
+    return false;
+  }
+
+  std::map<int, unsigned char> newKeys, newButtons;
+  std::string line;
+  for (int number = 1; getline(file, line); number++){
+    size_t comment = line.find('#');
+    if (comment != std::string::npos)
+      line.erase(comment);
+
+    std::istringstream fields(line);
+    unsigned int key;
+    std::string name;
+    if (!(fields >> std::hex >> key)){
+      continue; // blank line
+    }
+    bool ok = key < 16 && (fields >> name);
+    if (ok && name == "pad"){
+      SDL_GameControllerButton button = SDL_CONTROLLER_BUTTON_INVALID;
+      if (fields >> name)
+        button = SDL_GameControllerGetButtonFromString(name.c_str());
+      ok = button != SDL_CONTROLLER_BUTTON_INVALID;
+      if (ok)
+        newButtons[button] = key;
+    } else if (ok){
+      // Key names can have spaces in them ("Left Shift")
+      std::string rest;
+      getline(fields, rest);
+      name += rest;
+      name.erase(name.find_last_not_of(" \t\r") + 1);
+      SDL_Scancode scancode = SDL_GetScancodeFromName(name.c_str());
+      ok = scancode != SDL_SCANCODE_UNKNOWN;
+      if (ok)
+        newKeys[scancode] = key;
+    }
+    if (!ok){
+      printf("%s:%i: expected '<hex key> <key name>' or "
+        "'<hex key> pad <button name>'\n", path.c_str(), number);
+      return false;
+    }
+  }
+
+  keys = newKeys;
+  buttons = newButtons;
+  keyboardHeld = 0;
+  padHeld.clear();
+  return true;
+};
+
+void Controls::handleEvent(const SDL_Event & e){
+  if (e.type == SDL_KEYDOWN || e.type == SDL_KEYUP){
+    std::map<int, unsigned char>::const_iterator key =
+      keys.find(e.key.keysym.scancode);
+    if (key == keys.end())
+      return;
+    if (e.type == SDL_KEYDOWN)
+      keyboardHeld |= 1 << key->second;
+    else
+      keyboardHeld &= ~(1 << key->second);
+
+  } else if (e.type == SDL_CONTROLLERBUTTONDOWN ||
+      e.type == SDL_CONTROLLERBUTTONUP){
+    std::map<int, unsigned char>::const_iterator button =
+      buttons.find(e.cbutton.button);
+    if (button == buttons.end())
+      return;
+    if (e.type == SDL_CONTROLLERBUTTONDOWN)
+      padHeld[e.cbutton.which] |= 1 << button->second;
+    else
+      padHeld[e.cbutton.which] &= ~(1 << button->second);
+
+  } else if (e.type == SDL_CONTROLLERDEVICEADDED){
+    SDL_GameController * pad = SDL_GameControllerOpen(e.cdevice.which);
+    if (pad != NULL)
+      pads.push_back(pad);
+
+  } else if (e.type == SDL_CONTROLLERDEVICEREMOVED){
+    // Removal events carry the instance id rather than the device index
+    for (size_t i = 0; i < pads.size(); i++){
+      if (SDL_JoystickInstanceID(SDL_GameControllerGetJoystick(pads[i])) ==
+          e.cdevice.which){
+        SDL_GameControllerClose(pads[i]);
+        pads.erase(pads.begin() + i);
+        break;
+      }
+    }
+    // Its buttons won't be coming back up, but other pads' still will
+    padHeld.erase(e.cdevice.which);
+  }
+};
+
+uint16_t Controls::readKeys(){
+  uint16_t held = keyboardHeld;
+  for (std::map<SDL_JoystickID, uint16_t>::const_iterator pad =
+      padHeld.begin(); pad != padHeld.end(); ++pad)
+    held |= pad->second;
+  return held;
+};
+
+void Controls::shutdown(){
+  for (size_t i = 0; i < pads.size(); i++)
+    SDL_GameControllerClose(pads[i]);
+  pads.clear();
+  padHeld.clear();
+
+  if (padsStarted)
+    SDL_QuitSubSystem(SDL_INIT_GAMECONTROLLER);
+  padsStarted = false;
+};
@@ -0,0 +1,47 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include "io.h"
+#include <SDL2/SDL.h>      // SDL2
+#include <map>
+#include <string>
+#include <vector>
+
+// Keeps the keypad state up to date from SDL keyboard and game controller
+// events, using a key mapping that can be loaded from a file (see input.cpp).
+// Nothing is polled; readKeys just returns the mask the events left behind.
+// Closes any controllers it opened when destroyed
+class Controls : public InputSource
+{
+private:
+  // keypad key for each scancode / controller button that's mapped
+  std::map<int, unsigned char> keys;
+  std::map<int, unsigned char> buttons;
+
+  // keypad keys held on the keyboard, and on each controller by instance id
+  uint16_t keyboardHeld = 0;
+  std::map<SDL_JoystickID, uint16_t> padHeld;
+
+  std::vector<SDL_GameController *> pads;
+  bool padsStarted = false;
+
+public:
+  Controls();
+  Controls(const Controls &) = delete;
+  Controls & operator=(const Controls &) = delete;
+  ~Controls();
+
+  // Starts SDL's game controller support. Prints an error and returns false
+  // if it can't, in which case only the keyboard works
+  bool initialize();
+
+  // Replaces the default mapping. Prints an error and returns false (leaving
+  // the mapping alone) if the file can't be read
+  bool loadKeymap(const std::string & path);
+
+  void handleEvent(const SDL_Event & e);
+  uint16_t readKeys();
+  void shutdown();
+};
+
+#endif
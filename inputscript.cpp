@@ -0,0 +1,118 @@
+#include "inputscript.h"
+#include <fstream>
+#include <sstream>
+#include <stdio.h>      // printf
+
+InputScript::InputScript()
+  : hasSeed(false), seed(0), hz(0), hasQuirks(false), quirks(QUIRKS_DEFAULT),
+    hasEnd(false), endCycle(0), endHash(0), next(0), held(0){
+};
+
+bool InputScript::load(const string & path){
+  ifstream file(path);
+  if (!file.is_open()){
+    printf("Could not open input script '%s'\n", path.c_str());
+    return false;
+  }
+
+  changes.clear();
+  next = 0;
+  held = 0;
+  hasSeed = false;
+  hz = 0;
+  hasQuirks = false;
+  hasEnd = false;
+
+  string line;
+  for (int number = 1; getline(file, line); number++){
+    size_t comment = line.find('#');
+    if (comment != string::npos)
+      line.erase(comment);
+
+    istringstream fields(line);
+    string word;
+    if (!(fields >> word)){
+      continue; // blank line
+    }
+    if (word == "seed" || word == "hz" || word == "quirks" || word == "end"){
+      bool ok;
+      string name;
+      if (word == "seed")
+        ok = hasSeed = !!(fields >> seed);
+      else if (word == "hz")
+        ok = (fields >> hz) && hz > 0;
+      else if (word == "quirks")
+        ok = hasQuirks = (fields >> name) && quirkProfileFromName(name, quirks);
+      else
+        ok = hasEnd = !!(fields >> endCycle >> hex >> endHash);
+      if (!ok){
+        printf("%s:%i: bad '%s' line\n", path.c_str(), number, word.c_str());
+        return false;
+      }
+      continue;
+    }
+
+    fields.clear();
+    fields.str(line);
+    Change change;
+    unsigned int keys;
+    fields >> change.cycle;
+    if (!(fields >> hex >> keys) || keys > 0xFFFF ||
+        (!changes.empty() && change.cycle < changes.back().cycle)){
+      printf("%s:%i: expected '<cycle> <hex keys>' in cycle order\n",
+        path.c_str(), number);
+      return false;
+    }
+    change.keys = keys;
+    changes.push_back(change);
+  }
+
+  return true;
+};
+
+void InputScript::seek(unsigned long long cycle){
+  while (next < changes.size() && changes[next].cycle <= cycle){
+    held = changes[next].keys;
+    next++;
+  }
+};
+
+uint16_t InputScript::readKeys(){
+  return held;
+};
+
+InputRecorder::InputRecorder(InputSource & source)
+  : source(source), cycle(0), held(0){
+};
+
+void InputRecorder::seek(unsigned long long cycle){
+  this->cycle = cycle;
+};
+
+uint16_t InputRecorder::readKeys(){
+  uint16_t keys = source.readKeys();
+  if (keys != held)
+    changes.push_back(make_pair(cycle, keys));
+  held = keys;
+  return keys;
+};
+
+bool InputRecorder::save(const string & path, uint64_t seed, double hz,
+    QuirkProfile quirks, unsigned long long endCycle, uint64_t endHash){
+  FILE * file = fopen(path.c_str(), "w");
+  if (file == NULL){
+    printf("Could not write input recording '%s'\n", path.c_str());
+    return false;
+  }
+
+  fprintf(file, "seed %llu\nhz %.17g\nquirks %s\n", (unsigned long long)seed,
+    hz, quirkProfileName(quirks));
+  for (size_t i = 0; i < changes.size(); i++)
+    fprintf(file, "%llu %04x\n", changes[i].first, changes[i].second);
+  fprintf(file, "end %llu %016llx\n", endCycle, (unsigned long long)endHash);
+
+  bool ok = fclose(file) == 0;
+  if (!ok)
+    printf("Could not write input recording '%s'\n", path.c_str());
+  return ok;
+};
@@ -0,0 +1,88 @@
+#ifndef INPUTSCRIPT_H
+#define INPUTSCRIPT_H
+
+#include "io.h"
+#include "quirks.h"
+#include <stdint.h>     // uint16_t
+#include <string>
+#include <utility>      // pair
+#include <vector>
+using namespace std;
+
+/* Keypad input read from a script rather than a keyboard, for unattended
+   runs. Each line of a script is "<cycle> <keys>": from that cycle on, the
+   keys set in the hex mask <keys> are held (bit i for key i). Lines must be
+   in cycle order, and anything after a '#' is a comment, e.g.
+
+     # press 5 for a second at 500Hz, then hold 4 and 6
+     120  0020
+     620  0000
+     900  0050
+
+   Recordings (see InputRecorder) also say how the run was set up and how it
+   ended, so it can be replayed and checked:
+
+     seed 1234                  # the PRNG seed
+     hz 500                     # instructions per second
+     quirks schip               # the quirk profile (see quirks.h)
+     end 48213 9b4c0e1d2f3a4b5c # the final cycle count and screenHash()
+*/
+class InputScript : public InputSource
+{
+public:
+  InputScript();
+
+  // Prints an error and returns false if the script can't be read
+  bool load(const string & path);
+
+  // Moves to the keys held at the given cycle; cycles only go forward
+  void seek(unsigned long long cycle);
+
+  uint16_t readKeys();
+
+  // From the seed, hz, quirks and end lines, if the script has them
+  bool hasSeed;
+  uint64_t seed;
+  double hz;
+  bool hasQuirks;
+  QuirkProfile quirks;
+  bool hasEnd;
+  unsigned long long endCycle;
+  uint64_t endHash;
+
+private:
+  struct Change
+  {
+    unsigned long long cycle;
+    uint16_t keys;
+  };
+  vector<Change> changes;
+  size_t next;
+  uint16_t held;
+};
+
+// Passes keys through from another source, noting the cycle at which they
+// change so the run can be saved as an input script and replayed exactly
+class InputRecorder : public InputSource
+{
+public:
+  InputRecorder(InputSource & source);
+
+  // The cycle the next readKeys() happens at; cycles only go forward
+  void seek(unsigned long long cycle);
+
+  uint16_t readKeys();
+
+  // Writes the script, ending at the given cycle count and screen hash.
+  // Prints an error and returns false if it can't be written
+  bool save(const string & path, uint64_t seed, double hz,
+    QuirkProfile quirks, unsigned long long endCycle, uint64_t endHash);
+
+private:
+  InputSource & source;
+  unsigned long long cycle;
+  uint16_t held;
+  vector<pair<unsigned long long, uint16_t> > changes;
+};
+
+#endif
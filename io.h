@@ -0,0 +1,89 @@
+#ifndef IO_H
+#define IO_H
+
+#include <stdint.h>     // uint16_t, uint32_t, uint64_t
+
+/* Interfaces between the chip8 core and whatever is driving it. The core only
+   talks to these, so it can be built and run without SDL (or a display) */
+
+// Supplies the state of the 16 key hex keypad
+class InputSource
+{
+public:
+  virtual ~InputSource() {}
+
+  // Returns the keys held, bit i set for key i
+  virtual uint16_t readKeys() = 0;
+};
+
+// Read-only view of the core's framebuffer: 64x32, or 128x64 in SUPER-CHIP
+// high-res mode, in two bit-planes. Each plane is 64 rows of two 64 bit
+// words, with the leftmost pixel in the most significant bit of the first
+// word (planes[p][2 * y] and planes[p][2 * y + 1]); only the top left
+// width x height pixels are in use. A pixel's colour is its plane 0 bit plus
+// twice its plane 1 bit, and plain chip8 programs only use plane 0. The rows
+// belong to the core and change as it runs, so only read them between
+// emulated frames
+struct FrameView
+{
+  const uint64_t * planes[2];
+  unsigned int width;
+  unsigned int height;
+
+  // bit y is set if row y may have changed since the previous view was taken
+  uint64_t dirtyRows;
+
+  // goes up by one every time the program draws to or clears the screen
+  uint32_t sequence;
+};
+
+// Receives a view of the framebuffer whenever the program has drawn to it
+class VideoSink
+{
+public:
+  virtual ~VideoSink() {}
+
+  virtual void render(const FrameView & frame) = 0;
+
+  // Called once at the end of every emulated frame, whether or not anything
+  // was drawn. Sinks decide here whether (and what) to actually show
+  virtual void present() = 0;
+};
+
+// Told when the sound timer starts and stops running, and what to play
+class AudioSink
+{
+public:
+  virtual ~AudioSink() {}
+
+  virtual void setTone(bool on) = 0;
+
+  // XO-CHIP's 128 bit audio pattern (F002, first byte's top bit first) and
+  // its pitch (FX3A), to play while the tone is on in place of a plain beep.
+  // pattern is NULL while it's all zeros, as it is until a program loads one
+  virtual void setPattern(const unsigned char * pattern,
+    unsigned char pitch) = 0;
+};
+
+// Do-nothing implementations for headless runs
+class NullInput : public InputSource
+{
+public:
+  uint16_t readKeys() { return 0; }
+};
+
+class NullVideo : public VideoSink
+{
+public:
+  void render(const FrameView &) {}
+  void present() {}
+};
+
+class NullAudio : public AudioSink
+{
+public:
+  void setTone(bool) {}
+  void setPattern(const unsigned char *, unsigned char) {}
+};
+
+#endif
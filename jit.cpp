@@ -0,0 +1,478 @@
+#include "jit.h"
+#include "chip8.h"
+#include <algorithm>    // sort
+#include <string.h>     // memcpy, memmove, memset
+#include <utility>      // pair
+#include <vector>
+using namespace std;
+
+#if defined(__x86_64__) && (defined(__linux__) || defined(__APPLE__))
+#define JIT_X86_64 1
+#include <sys/mman.h>   // mmap, mprotect
+#include <unistd.h>     // sysconf
+#endif
+
+// Longest run of instructions translated into one block, and the most native
+// code that can take: no instruction needs more than 40 bytes, plus 10 for
+// the budget check and 12 for its way out, and 12 to end the block
+const unsigned short maxBlockLength = 64;
+const size_t maxBlockBytes = maxBlockLength * 64 + 16;
+
+#ifdef JIT_X86_64
+
+/* Writes x86-64 machine code. The generated block is called as
+   unsigned int block(Chip8 * chip8, unsigned int budget), so rdi points at
+   the Chip8 and every register access is a [rdi + disp32] operand, and esi
+   counts down the budget. Only rax and rcx are used as scratch, and nothing
+   is called, so there's no stack frame to set up */
+class Emitter
+{
+public:
+  Emitter(unsigned char * start) : start(start), out(start) {}
+
+  size_t size() const { return out - start; }
+
+  // Throws away everything written after the first size bytes
+  void truncate(size_t size){ out = start + size; }
+
+  // Points the rel32 operand written at offset at the current position
+  void patch(size_t offset){
+    int rel = size() - (offset + 4);
+    for (int i = 0; i < 4; i++)
+      start[offset + i] = (rel >> (i * 8)) & 0xFF;
+  }
+
+  void byte(unsigned char b){ *out++ = b; }
+
+  void word(unsigned short w){
+    byte(w & 0xFF);
+    byte(w >> 8);
+  }
+
+  void dword(int d){
+    for (int i = 0; i < 4; i++)
+      byte((d >> (i * 8)) & 0xFF);
+  }
+
+  void qword(uint64_t q){
+    for (int i = 0; i < 8; i++)
+      byte((q >> (i * 8)) & 0xFF);
+  }
+
+  // op reg, [rdi + disp] (or op [rdi + disp], reg / op /ext [rdi + disp])
+  void mem(unsigned char op, unsigned char reg, int disp){
+    byte(op);
+    byte(0x80 | (reg << 3) | 7);
+    dword(disp);
+  }
+
+private:
+  unsigned char * start;
+  unsigned char * out;
+};
+
+// x86 register numbers used as the reg field of a ModRM byte
+const unsigned char AL = 0;
+const unsigned char CL = 1;
+
+#endif
+
+Jit::Jit() : buffer(NULL), capacity(0), used(0), pageSize(4096),
+    anyCovered(false){
+#ifdef JIT_X86_64
+  // Room for the longest possible block at every address, so there's always
+  // space once dropped blocks are cleared out. Pages are only backed once
+  // code is written to them, so it costs nothing until it's needed
+  size_t size = sizeof(blocks) / sizeof(blocks[0]) * maxBlockBytes;
+  void * p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (p != MAP_FAILED){
+    buffer = (unsigned char *)p;
+    capacity = size;
+  }
+  long page = sysconf(_SC_PAGESIZE);
+  if (page > 0)
+    pageSize = page;
+#endif
+  flush();
+};
+
+Jit::~Jit(){
+#ifdef JIT_X86_64
+  if (buffer != NULL)
+    munmap(buffer, capacity);
+#endif
+};
+
+bool Jit::available() const {
+  return buffer != NULL;
+};
+
+void Jit::flush(){
+  for (unsigned int i = 0; i < sizeof(blocks) / sizeof(blocks[0]); i++){
+    blocks[i].code = NULL;
+    blocks[i].length = 0;
+    blocks[i].owner = 0;
+    blocks[i].size = 0;
+    blocks[i].translated = false;
+  }
+  memset(covered, 0, sizeof(covered));
+  anyCovered = false;
+  used = 0;
+};
+
+void Jit::protect(size_t offset, size_t size, bool writable){
+#ifdef JIT_X86_64
+  uintptr_t first = (uintptr_t)(buffer + offset) & ~(uintptr_t)(pageSize - 1);
+  uintptr_t end = ((uintptr_t)(buffer + offset + size) + pageSize - 1) &
+    ~(uintptr_t)(pageSize - 1);
+  mprotect((void *)first, end - first,
+    PROT_READ | (writable ? PROT_WRITE : PROT_EXEC));
+#else
+  (void)offset;
+  (void)size;
+  (void)writable;
+#endif
+};
+
+void Jit::compact(){
+  // The blocks still in use, in the order their code is laid out
+  vector<pair<unsigned char *, unsigned short> > live;
+  for (unsigned int a = 0x200; a < 0xFFF; a++){
+    const Block & block = blocks[a - 0x200];
+    if (block.code != NULL && block.owner == a)
+      live.push_back(make_pair((unsigned char *)block.code, (unsigned short)a));
+  }
+  sort(live.begin(), live.end());
+
+  // Code only refers to the Chip8, the table of blocks and itself, so it can
+  // be moved as is
+  protect(0, used, true);
+  ptrdiff_t moved[0xFFF - 0x200];
+  size_t end = 0;
+  for (size_t i = 0; i < live.size(); i++){
+    unsigned short owner = live[i].second;
+    size_t size = blocks[owner - 0x200].size;
+    memmove(buffer + end, live[i].first, size);
+    moved[owner - 0x200] = buffer + end - live[i].first;
+    end += size;
+  }
+  protect(0, used, false);
+  used = end;
+
+  for (unsigned int a = 0x200; a < 0xFFF; a++){
+    Block & entry = blocks[a - 0x200];
+    if (entry.code != NULL)
+      entry.code = reinterpret_cast<Code>(
+        (unsigned char *)entry.code + moved[entry.owner - 0x200]);
+  }
+};
+
+void Jit::drop(unsigned short address){
+  unsigned short length = blocks[address - 0x200].length;
+  for (unsigned int a = address; a < address + 2u * length; a++){
+    covered[a]--;
+    Block & entry = blocks[a - 0x200];
+    if (entry.code != NULL && entry.owner == address){
+      entry.code = NULL;
+      entry.length = 0;
+      entry.translated = false;
+    }
+  }
+};
+
+void Jit::invalidate(unsigned short address, unsigned short length){
+  unsigned int first = address > 0x200 ? address - 1 : 0x200;
+  unsigned int last = address + length;
+  if (last > 0xFFF)
+    last = 0xFFF;
+
+  // Drop the blocks the write hit; none can be longer than maxBlockLength,
+  // so only ones starting a little before it need looking at
+  if (anyCovered){
+    bool hit = false;
+    for (unsigned int a = address; a < last && !hit; a++)
+      hit = covered[a] != 0;
+    unsigned int a = address > 0x200 + 2 * maxBlockLength ?
+      address - 2 * maxBlockLength : 0x200;
+    for (; hit && a < last; a++){
+      const Block & block = blocks[a - 0x200];
+      if (block.code != NULL && block.owner == a &&
+          a + 2 * block.length > address)
+        drop(a);
+    }
+  }
+
+  // Forget anything decided about addresses whose instruction changed
+  for (unsigned int a = first; a < last; a++)
+    blocks[a - 0x200].translated = false;
+};
+
+const Jit::Block & Jit::lookup(Chip8 & chip8, unsigned short address){
+  Block & block = blocks[address - 0x200];
+  if (!block.translated)
+    translate(chip8, address, block);
+  return block;
+};
+
+void Jit::translate(Chip8 & c, unsigned short address, Block & block){
+#ifdef JIT_X86_64
+  if (buffer == NULL){
+    block.translated = true;
+    return;
+  }
+
+  block.translated = true;
+  block.code = NULL;
+  block.length = 0;
+
+  if (capacity - used < maxBlockBytes)
+    compact();
+
+  // Offsets of the machine state from the Chip8 pointer passed in rdi
+  const unsigned char * base = (const unsigned char *)&c;
+  int vOffset = (const unsigned char *)c.V - base;
+  int vf = vOffset + 0xF;
+  int iOffset = (const unsigned char *)&c.I - base;
+  int pcOffset = (const unsigned char *)&c.pc - base;
+  int dtOffset = (const unsigned char *)&c.delay_timer - base;
+  int stOffset = (const unsigned char *)&c.sound_timer - base;
+
+  // Blocks are thrown away when the profile changes, so its quirks can be
+  // compiled in
+  const Quirks quirks = quirksOf(c.quirks);
+
+  // Code is written out of the way first, so the buffer only has to be made
+  // writable (two system calls) when something was actually translated
+  unsigned char code[maxBlockBytes];
+  Emitter e(code);
+
+  // Where each instruction's code starts, and its jump out if the budget has
+  // run out, which is patched once the block's ending is written
+  size_t entries[maxBlockLength];
+  size_t exits[maxBlockLength];
+
+  unsigned short pc = address;
+  unsigned short count = 0;
+  bool jumped = false;
+  while (count < maxBlockLength && pc < 0xFFF && !jumped){
+    unsigned short opcode = c.memory[pc] << 8 | c.memory[pc + 1];
+    unsigned short nnn = opcode & 0x0FFF;
+    unsigned char nn = opcode & 0x00FF;
+    int vx = vOffset + ((opcode & 0x0F00) >> 8);
+    int vy = vOffset + ((opcode & 0x00F0) >> 4);
+    bool translated = true;
+
+    entries[count] = e.size();
+    e.byte(0x85); e.byte(0xF6);                            // test esi, esi
+    e.byte(0x0F); e.byte(0x84);                            // jz exit
+    exits[count] = e.size(); e.dword(0);
+    e.byte(0xFF); e.byte(0xCE);                            // dec esi
+
+    switch (opcode & 0xF000){
+      case 0x1000: // 1NNN: pc = NNN and end the block
+        e.byte(0x66); e.mem(0xC7, 0, pcOffset); e.word(nnn);
+        jumped = true;
+        // Go straight on to the code at NNN if it's been translated, with
+        // what's left of the budget. It's looked up each time, so there's
+        // nothing to undo when that block is dropped
+        if (nnn >= 0x200 && nnn < 0xFFF){
+          e.byte(0x48); e.byte(0xB8);                      // mov rax, &code
+          e.qword((uintptr_t)&blocks[nnn - 0x200].code);
+          e.byte(0x48); e.byte(0x8B); e.byte(0x00);        // mov rax, [rax]
+          e.byte(0x48); e.byte(0x85); e.byte(0xC0);        // test rax, rax
+          e.byte(0x74); e.byte(0x02);                      // jz +2
+          e.byte(0xFF); e.byte(0xE0);                      // jmp rax
+        }
+        break;
+
+      case 0x6000: // 6XNN: mov byte [VX], NN
+        e.mem(0xC6, 0, vx); e.byte(nn);
+        break;
+
+      case 0x7000: // 7XNN: add byte [VX], NN
+        e.mem(0x80, 0, vx); e.byte(nn);
+        break;
+
+      case 0x8000:
+        switch (opcode & 0x000F){
+          case 0x0: // 8XY0: VX = VY
+            e.mem(0x8A, AL, vy); e.mem(0x88, AL, vx);
+            break;
+          case 0x1: // 8XY1: VX |= VY
+            e.mem(0x8A, AL, vy); e.mem(0x08, AL, vx);
+            if (quirks.logicResetsVF){
+              e.mem(0xC6, 0, vf); e.byte(0);               // mov byte [VF], 0
+            }
+            break;
+          case 0x2: // 8XY2: VX &= VY
+            e.mem(0x8A, AL, vy); e.mem(0x20, AL, vx);
+            if (quirks.logicResetsVF){
+              e.mem(0xC6, 0, vf); e.byte(0);
+            }
+            break;
+          case 0x3: // 8XY3: VX ^= VY
+            e.mem(0x8A, AL, vy); e.mem(0x30, AL, vx);
+            if (quirks.logicResetsVF){
+              e.mem(0xC6, 0, vf); e.byte(0);
+            }
+            break;
+
+          // The flag is written before VX is updated (and VX/VY re-read
+          // afterwards) to match the interpreter when X or Y is F
+          case 0x4: // 8XY4: VF = carry of VX + VY, VX += VY
+            e.mem(0x8A, AL, vx); e.mem(0x02, AL, vy);
+            e.byte(0x0F); e.byte(0x92); e.byte(0xC1);      // setc cl
+            e.mem(0x88, CL, vf);
+            e.mem(0x8A, AL, vy); e.mem(0x00, AL, vx);
+            break;
+          case 0x5: // 8XY5: VF = VX >= VY, VX -= VY
+            e.mem(0x8A, AL, vx); e.mem(0x3A, AL, vy);
+            e.byte(0x0F); e.byte(0x93); e.byte(0xC1);      // setae cl
+            e.mem(0x88, CL, vf);
+            e.mem(0x8A, AL, vy); e.mem(0x28, AL, vx);
+            break;
+          // Shifts read their source once and write VF last, like the
+          // interpreter; the source is VY with the shiftVY quirk
+          case 0x6: // 8XY6: VX = source >> 1, VF = source & 1
+            e.mem(0x8A, AL, quirks.shiftVY ? vy : vx);
+            e.byte(0x88); e.byte(0xC1);                    // mov cl, al
+            e.byte(0xD0); e.byte(0xE8);                    // shr al, 1
+            e.mem(0x88, AL, vx);
+            e.byte(0x80); e.byte(0xE1); e.byte(0x01);      // and cl, 1
+            e.mem(0x88, CL, vf);
+            break;
+          case 0x7: // 8XY7: VF = VY >= VX, VX = VY - VX
+            e.mem(0x8A, AL, vy); e.mem(0x3A, AL, vx);
+            e.byte(0x0F); e.byte(0x93); e.byte(0xC1);      // setae cl
+            e.mem(0x88, CL, vf);
+            e.mem(0x8A, AL, vy); e.mem(0x2A, AL, vx); e.mem(0x88, AL, vx);
+            break;
+          case 0xE: // 8XYE: VX = source << 1, VF = source >> 7
+            e.mem(0x8A, AL, quirks.shiftVY ? vy : vx);
+            e.byte(0x88); e.byte(0xC1);                    // mov cl, al
+            e.byte(0xD0); e.byte(0xE0);                    // shl al, 1
+            e.mem(0x88, AL, vx);
+            e.byte(0xC0); e.byte(0xE9); e.byte(0x07);      // shr cl, 7
+            e.mem(0x88, CL, vf);
+            break;
+          default:
+            translated = false;
+            break;
+        }
+        break;
+
+      case 0xA000: // ANNN: mov word [I], NNN
+        e.byte(0x66); e.mem(0xC7, 0, iOffset); e.word(nnn);
+        break;
+
+      case 0xF000:
+        switch (nn){
+          case 0x07: // FX07: VX = delay timer
+            e.mem(0x8A, AL, dtOffset); e.mem(0x88, AL, vx);
+            break;
+          case 0x15: // FX15: delay timer = VX
+            e.mem(0x8A, AL, vx); e.mem(0x88, AL, dtOffset);
+            break;
+          case 0x18: // FX18: sound timer = VX
+            e.mem(0x8A, AL, vx); e.mem(0x88, AL, stOffset);
+            break;
+          case 0x1E: // FX1E: I += VX
+            e.byte(0x0F); e.mem(0xB6, AL, vx);             // movzx eax, [VX]
+            e.byte(0x66); e.mem(0x01, AL, iOffset);        // add [I], ax
+            break;
+          case 0x29: // FX29: I = VX * 5
+            e.byte(0x0F); e.mem(0xB6, AL, vx);             // movzx eax, [VX]
+            e.byte(0x8D); e.byte(0x04); e.byte(0x80);      // lea eax, [rax+rax*4]
+            e.byte(0x66); e.mem(0x89, AL, iOffset);        // mov [I], ax
+            break;
+          default:
+            translated = false;
+            break;
+        }
+        break;
+
+      default:
+        translated = false;
+        break;
+    }
+
+    if (!translated){
+      e.truncate(entries[count]);
+      break;
+    }
+    count++;
+    if (!jumped)
+      pc += 2;
+  }
+
+  if (count > 0){
+    if (!jumped){
+      e.byte(0x66); e.mem(0xC7, 0, pcOffset); e.word(pc);
+    }
+    e.byte(0x89); e.byte(0xF0);                            // mov eax, esi
+    e.byte(0xC3);                                          // ret
+
+    // Out of budget before instruction i: pc is left pointing at it
+    for (unsigned short i = 0; i < count; i++){
+      e.patch(exits[i]);
+      e.byte(0x66); e.mem(0xC7, 0, pcOffset); e.word(address + 2 * i);
+      e.byte(0x89); e.byte(0xF0);                          // mov eax, esi
+      e.byte(0xC3);                                        // ret
+    }
+
+    unsigned char * start = buffer + used;
+    protect(used, e.size(), true);
+    memcpy(start, code, e.size());
+    protect(used, e.size(), false);
+    used += e.size();
+
+    // Every instruction of the block can be entered on its own, unless an
+    // earlier block already covers it
+    for (unsigned short i = 0; i < count; i++){
+      Block & entry = blocks[address + 2 * i - 0x200];
+      if (i > 0 && entry.code != NULL)
+        continue;
+      entry.code = reinterpret_cast<Code>(start + entries[i]);
+      entry.length = count - i;
+      entry.owner = address;
+      entry.translated = true;
+    }
+    block.size = e.size();
+
+    for (unsigned int a = address; a < address + 2u * count; a++)
+      covered[a]++;
+    anyCovered = true;
+  }
+#else
+  (void)c;
+  (void)address;
+  block.translated = true;
+#endif
+};
+
+unsigned int Chip8::runJit(unsigned int cycles){
+  unsigned int i = 0;
+  while (i < cycles){
+    if (pc >= 0x200 && pc < 0xFFF){
+      const Jit::Block & block = jit->lookup(*this, pc);
+      if (block.code != NULL){
+        unsigned int budget = cycles - i;
+        i += budget - block.code(this, budget);
+        continue;
+      }
+    }
+
+    // Whatever ended the block runs on the cached engine
+    if (pc >= 0x200 && pc < 0xFFF){
+      const Instruction & in = decoded[pc - 0x200];
+      in.handler(*this, in);
+      if (exited)
+        return i;
+    } else if (!emulateCycle()){
+      return i;
+    }
+    i++;
+  }
+  return cycles;
+};
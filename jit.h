@@ -0,0 +1,77 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <stddef.h>     // size_t
+
+class Chip8;
+
+/* Dynamic recompiler for x86-64. Straight-line runs of register/timer/index
+   instructions are translated into native code the first time they're run and
+   cached by start address. Anything else (calls, returns, skips, DXYN, FX0A,
+   memory access, ...) ends the block and is left to the cached engine.
+
+   Blocks are given the number of instructions left in the batch, check it
+   before every instruction and stop early if it runs out, so they can be run
+   whatever the batch size. Every instruction in a block is also an entry
+   point, so a batch that ends part way through resumes in the same code.
+
+   On other platforms, or if executable memory can't be allocated, available()
+   is false and the JIT engine behaves exactly like the cached engine */
+class Jit
+{
+public:
+  // Runs up to budget instructions and returns how many of them are left
+  typedef unsigned int (*Code)(Chip8 * chip8, unsigned int budget);
+
+  struct Block
+  {
+    Code code;                 // NULL if nothing could be translated here
+    unsigned short length;     // chip8 instructions from here to the end
+    unsigned short owner;      // address of the block the code belongs to
+    unsigned short size;       // bytes of code, at the block's own address
+    bool translated;           // false until the address has been looked at
+  };
+
+  Jit();
+  ~Jit();
+
+  bool available() const;
+
+  // The block starting at address, translating it first if needed
+  const Block & lookup(Chip8 & chip8, unsigned short address);
+
+  // Drop any blocks that were translated from [address, address + length)
+  void invalidate(unsigned short address, unsigned short length);
+
+  // Drop every block
+  void flush();
+
+private:
+  Jit(const Jit &);
+  Jit & operator=(const Jit &);
+
+  // Blocks are packed one after another. Dropped ones leave gaps, and when
+  // the buffer fills up the blocks still in use are moved down over them
+  unsigned char * buffer;
+  size_t capacity;
+  size_t used;
+  size_t pageSize;
+
+  Block blocks[0xFFF - 0x200];
+
+  // how many translated blocks were compiled from each byte of memory
+  unsigned char covered[0x1000];
+  bool anyCovered;
+
+  void translate(Chip8 & chip8, unsigned short address, Block & block);
+
+  // Forget the block starting at address, and every entry into its code
+  void drop(unsigned short address);
+
+  void compact();
+
+  // Makes buffer[offset, offset + size) writable, or executable again
+  void protect(size_t offset, size_t size, bool writable);
+};
+
+#endif
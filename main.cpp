@@ -1,74 +1,507 @@
+#include "audio.h"
 #include "chip8.h"
-#include <cstdlib>        // exit
+#include "gpu.h"
+#include "handoff.h"
+#include "input.h"
+#include "inputscript.h"
+#include "profiler.h"
+#include "rewind.h"
+#include "scheduler.h"
+#include <atomic>
+#include <csignal>        // signal, sig_atomic_t
+#include <cstdlib>        // exit, strtod, strtoull
+#include <cstring>        // strcmp
+#include <ctime>          // time
+#include <fstream>
+#include <iterator>       // istreambuf_iterator
 #include <SDL2/SDL.h>     // SDL2
- 
-int main(int argc, char **argv)
+#include <thread>
+
+// Waits for the start of each 60Hz frame. Frames are timed against the high
+// resolution counter, but the wait is all slept: SDL_Delay only sleeps in
+// whole milliseconds, so a frame may start up to a millisecond late, which
+// doesn't add up since the next one is still due at its own time
+class FramePacer
 {
-  if (argc != 2){
-    printf("Incorrect arguments. Please run as: ./main rom/path\n");
-    std::exit(0);
+public:
+  FramePacer()
+    : perfFreq(SDL_GetPerformanceFrequency()),
+      frameTicks(perfFreq / frameRate),
+      nextFrame(SDL_GetPerformanceCounter()) {}
+
+  void wait(){
+    nextFrame += frameTicks;
+    Uint64 now = SDL_GetPerformanceCounter();
+    if (now >= nextFrame){
+      // Running behind (e.g. the window was dragged); don't try to catch up
+      // with a burst of frames
+      if (now - nextFrame > frameTicks)
+        nextFrame = now;
+      return;
+    }
+
+    // Rounded up, so it never wakes early
+    SDL_Delay((Uint32)(((nextFrame - now) * 1000 + perfFreq - 1) / perfFreq));
+  }
+
+private:
+  Uint64 perfFreq;
+  Uint64 frameTicks;
+  Uint64 nextFrame;
+};
+
+// Quick save slot, written next to the rom
+bool saveStateFile(Chip8 & chip8, const string & path){
+  vector<unsigned char> state;
+  chip8.saveState(state);
+  ofstream file(path, ios::out|ios::binary|ios::trunc);
+  file.write((const char *)&state[0], state.size());
+  if (!file.good()){
+    printf("Could not write save state '%s'\n", path.c_str());
+    return false;
   }
+  printf("Saved state to '%s'\n", path.c_str());
+  return true;
+}
 
+bool loadStateFile(Chip8 & chip8, const string & path){
+  ifstream file(path, ios::in|ios::binary);
+  if (!file.is_open()){
+    printf("Could not open save state '%s'\n", path.c_str());
+    return false;
+  }
+  vector<unsigned char> state((istreambuf_iterator<char>(file)),
+    istreambuf_iterator<char>());
+  if (!chip8.loadState(state))
+    return false;
+  printf("Loaded state from '%s'\n", path.c_str());
+  return true;
+}
+
+// Set by SIGUSR1 to ask for the --stats report so far
+static volatile sig_atomic_t statsRequested = 0;
+
+void requestStats(int){
+  statsRequested = 1;
+}
+
+// Hotkeys handled by the front end rather than passed to the program
+enum StateCommand
+{
+  STATE_NONE,
+  STATE_SAVE,   // F5
+  STATE_LOAD    // F9
+};
+
+StateCommand stateCommand(const SDL_Event & e){
+  if (e.type != SDL_KEYDOWN || e.key.repeat)
+    return STATE_NONE;
+  if (e.key.keysym.scancode == SDL_SCANCODE_F5)
+    return STATE_SAVE;
+  if (e.key.keysym.scancode == SDL_SCANCODE_F9)
+    return STATE_LOAD;
+  return STATE_NONE;
+}
+
+void usage(){
+  printf("Usage: ./main.out [options] rom/path\n");
+  printf("  --hz N          instructions per second (default 500)\n");
+  printf("  --unthrottled   run as fast as possible\n");
+  printf("  --headless      run without a window, input or sound (implies\n");
+  printf("                  --unthrottled) and print the final screen\n");
+  printf("  --cycles N      stop after N instructions\n");
+  printf("  --engine E      interpreter (default), cached or jit\n");
+  printf("  --seed N        seed for CXNN's random numbers (default: the time)\n");
+  printf("  --quirks Q      behave like another interpreter where they differ:\n");
+  printf("                  default, vip, chip48, schip or xochip (see quirks.h)\n");
+  printf("  --keymap F      load the key and controller mapping from F (see\n");
+  printf("                  input.cpp)\n");
+  printf("  --threaded      run the emulator on its own thread, so presenting\n");
+  printf("                  never holds it up\n");
+  printf("  --record F      write the keys pressed to F, so the run can be\n");
+  printf("                  replayed (see inputscript.h)\n");
+  printf("  --replay F      rerun a recording headless and check that it ends\n");
+  printf("                  on the same screen (takes --seed, --hz, --quirks\n");
+  printf("                  and --cycles from the recording)\n");
+  printf("  --present P     latest (default), blend (ORs the last two frames\n");
+  printf("                  to reduce flicker) or vsync (one frame per\n");
+  printf("                  display refresh, replaces --hz pacing)\n");
+  printf("  --profile F     sample the program's call stack and write it to F\n");
+  printf("                  as folded stacks for flame graph tools\n");
+  printf("  --labels F      name addresses in the profile from F (see\n");
+  printf("                  profiler.h)\n");
+  printf("  --stats         count instructions by opcode and address, draws and\n");
+  printf("                  frames, and print them on exit (or on SIGUSR1);\n");
+  printf("                  counting always runs on the interpreter\n");
+  printf("While running, F5 saves the state to rom/path.state, F9 loads it\n");
+  printf("back, and holding backspace rewinds (up to a minute); while\n");
+  printf("recording, only F5 works\n");
+}
+
+int main(int argc, char **argv)
+{
   // ops per second, chip8 has no standard but this seems to make things run
   // at a nice speed
-  const double hz = 500;
+  double hz = 500;
+  bool unthrottled = false;
+  bool headless = false;
+  bool threaded = false;
+  bool showStats = false;
+  unsigned long long maxCycles = 0;
+  Engine engine = ENGINE_INTERPRETER;
+  QuirkProfile quirks = QUIRKS_DEFAULT;
+  uint64_t seed = time(NULL);
+  bool seeded = false;
+  PresentMode presentMode = PRESENT_LATEST;
+  const char * rom = NULL;
+  const char * recordPath = NULL;
+  const char * replayPath = NULL;
+  const char * keymapPath = NULL;
+  const char * profilePath = NULL;
+  const char * labelsPath = NULL;
+
+  for (int i = 1; i < argc; i++){
+    if (strcmp(argv[i], "--hz") == 0 && i + 1 < argc){
+      hz = strtod(argv[++i], NULL);
+    } else if (strcmp(argv[i], "--unthrottled") == 0){
+      unthrottled = true;
+    } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc){
+      seed = strtoull(argv[++i], NULL, 0);
+      seeded = true;
+    } else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc){
+      recordPath = argv[++i];
+    } else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc){
+      replayPath = argv[++i];
+    } else if (strcmp(argv[i], "--keymap") == 0 && i + 1 < argc){
+      keymapPath = argv[++i];
+    } else if (strcmp(argv[i], "--threaded") == 0){
+      threaded = true;
+    } else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc){
+      profilePath = argv[++i];
+    } else if (strcmp(argv[i], "--labels") == 0 && i + 1 < argc){
+      labelsPath = argv[++i];
+    } else if (strcmp(argv[i], "--stats") == 0){
+      showStats = true;
+    } else if (strcmp(argv[i], "--headless") == 0){
+      headless = true;
+      unthrottled = true;
+    } else if (strcmp(argv[i], "--cycles") == 0 && i + 1 < argc){
+      maxCycles = strtoull(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--engine") == 0 && i + 1 < argc){
+      i++;
+      if (strcmp(argv[i], "interpreter") == 0){
+        engine = ENGINE_INTERPRETER;
+      } else if (strcmp(argv[i], "cached") == 0){
+        engine = ENGINE_CACHED;
+      } else if (strcmp(argv[i], "jit") == 0){
+        engine = ENGINE_JIT;
+      } else {
+        usage();
+        std::exit(0);
+      }
+    } else if (strcmp(argv[i], "--quirks") == 0 && i + 1 < argc){
+      if (!quirkProfileFromName(argv[++i], quirks)){
+        usage();
+        std::exit(0);
+      }
+    } else if (strcmp(argv[i], "--present") == 0 && i + 1 < argc){
+      i++;
+      if (strcmp(argv[i], "latest") == 0){
+        presentMode = PRESENT_LATEST;
+      } else if (strcmp(argv[i], "blend") == 0){
+        presentMode = PRESENT_BLEND;
+      } else if (strcmp(argv[i], "vsync") == 0){
+        presentMode = PRESENT_VSYNC;
+      } else {
+        usage();
+        std::exit(0);
+      }
+    } else if (argv[i][0] != '-' && rom == NULL){
+      rom = argv[i];
+    } else {
+      usage();
+      std::exit(0);
+    }
+  }
+
+  if (rom == NULL || hz <= 0 || (recordPath != NULL && replayPath != NULL)){
+    printf("Incorrect arguments. ");
+    usage();
+    std::exit(0);
+  }
+
+  // Replays run headless and as fast as possible, set up like the recording
+  InputScript replay;
+  if (replayPath != NULL){
+    if (!replay.load(replayPath))
+      std::exit(1);
+    headless = true;
+    unthrottled = true;
+    if (replay.hasSeed){
+      seed = replay.seed;
+      seeded = true;
+    }
+    if (replay.hz > 0)
+      hz = replay.hz;
+    if (replay.hasQuirks)
+      quirks = replay.quirks;
+    if (replay.hasEnd)
+      maxCycles = replay.endCycle;
+  }
+
   Chip8 chip8;
   Gpu gpu;
+  Controls controls;
+  Beeper beeper;
+  NullVideo nullVideo;
+  NullInput nullInput;
+  NullAudio nullAudio;
 
-  // Run unit tests before we do anything
-  chip8.selfTest();
+  // Headless runs never touch SDL
+  VideoSink * video = &nullVideo;
+  InputSource * input = &nullInput;
+  AudioSink * audio = &nullAudio;
 
-  // Set up render system and register input callbacks
-  if (not gpu.initialize())
-    std::exit(0);
- 
-  // Initialize the Chip8 system and load the game into the memory  
+  if (!headless){
+    // Set up render system and register input callbacks
+    if (not gpu.initialize(presentMode))
+      std::exit(0);
+    video = &gpu;
+    // Keyboard only is fine too
+    controls.initialize();
+    if (keymapPath != NULL && !controls.loadKeymap(keymapPath))
+      std::exit(1);
+    input = &controls;
+    // No sound isn't worth stopping for
+    if (beeper.initialize())
+      audio = &beeper;
+  }
+  if (replayPath != NULL)
+    input = &replay;
+
+  // In threaded mode the core reads keys handed over by the front end
+  SharedKeypad keys;
+  if (threaded && !headless)
+    input = &keys;
+
+  // Recording just notes the keys on their way through. Loading states or
+  // rewinding would make the recording impossible to replay
+  InputRecorder recorder(*input);
+  if (recordPath != NULL)
+    input = &recorder;
+  bool timeTravel = recordPath == NULL;
+
+  // Initialize the Chip8 system and load the game into the memory
+  printf("Loading rom '%s'...\n", rom);
+  if (!seeded)
+    printf("Random seed %llu (pass --seed to repeat this run)\n",
+      (unsigned long long)seed);
+  chip8.seed(seed);
   chip8.initialize();
-  chip8.loadGame(argv[1]);
- 
+  chip8.setEngine(engine);
+  chip8.setQuirks(quirks);
+  chip8.attachAudio(audio);
+  if (!chip8.loadGame(rom))
+    std::exit(1);
+
+  Profiler profiler;
+  if (labelsPath != NULL && !profiler.loadLabels(labelsPath))
+    std::exit(1);
+  if (profilePath != NULL)
+    chip8.attachProfiler(&profiler);
+
+  Stats stats;
+  if (showStats){
+    chip8.attachStats(&stats);
+#ifdef SIGUSR1
+    signal(SIGUSR1, requestStats);
+#endif
+  }
+
   // Emulation loop
   printf("Finished loading, now running\n");
-  bool running;
+
+  Scheduler scheduler(hz, maxCycles);
+  // Headless, nothing can get a program out of a jump to itself, so the run
+  // ends there instead of spinning forever (replays that record where they
+  // ended still run to that cycle)
+  scheduler.stopWhenStuck(headless && !(replayPath != NULL && replay.hasEnd));
+  Rewind rewind;
+  string statePath = string(rom) + ".state";
+  bool quit = false;
   SDL_Event e;
-  Uint32 tStart;
-  Uint32 frameTime;
-  for(;;)
-  {
-    tStart = SDL_GetTicks();
-
-    // Check for an SDL quit event
-    while(SDL_PollEvent(&e) != 0)
+
+  // Scripted and recorded input is keyed by the cycle each frame starts at
+  auto runFrame = [&]{
+    replay.seek(scheduler.totalCycles);
+    recorder.seek(scheduler.totalCycles);
+    return scheduler.runFrame(chip8, *input);
+  };
+
+  if (threaded && !headless){
+    // The core runs on its own thread, publishing finished frames through a
+    // triple buffer and reading keys from an atomic bitmask, so this thread
+    // only handles SDL events and presenting, and a slow present (e.g. waiting
+    // on vsync) never holds up emulation
+    TripleBuffer frames;
+    std::atomic<bool> stop(false);
+    std::atomic<bool> finished(false);
+    std::atomic<bool> rewinding(false);
+    std::atomic<int> command(STATE_NONE);
+
+    std::thread worker([&]{
+      FramePacer pacer;
+      while (!stop.load()){
+        int pending = command.exchange(STATE_NONE);
+        if (pending == STATE_SAVE)
+          saveStateFile(chip8, statePath);
+        else if (pending == STATE_LOAD && timeTravel)
+          loadStateFile(chip8, statePath);
+
+        bool more = true;
+        if (rewinding.load()){
+          rewind.pop(chip8);
+        } else {
+          more = runFrame();
+          rewind.push(chip8);
+        }
+        if (chip8.drawFlag)
+          frames.publish(chip8.getFrame());
+        // (the present count belongs to the window's thread, so it's only
+        // filled in at the end)
+        if (statsRequested){
+          statsRequested = 0;
+          stats.report(stdout);
+        }
+        if (!more)
+          break;
+        // Even unthrottled, a program waiting for input only needs running
+        // once a frame
+        WaitState wait = chip8.waitState();
+        if (!unthrottled || wait == WAIT_KEY || wait == WAIT_FOREVER)
+          pacer.wait();
+      }
+      finished.store(true);
+    });
+
+    FramePacer pacer;
+    while (!finished.load() && !quit)
     {
-      //User requests quit
-      if(e.type == SDL_QUIT)
+      while(SDL_PollEvent(&e) != 0)
       {
-        gpu.shutdown();
-        chip8.shutdown();
+        //User requests quit
+        if(e.type == SDL_QUIT)
+          quit = true;
+        if (stateCommand(e) != STATE_NONE)
+          command.store(stateCommand(e));
+        controls.handleEvent(e);
       }
+
+      rewinding.store(timeTravel &&
+        SDL_GetKeyboardState(NULL)[SDL_SCANCODE_BACKSPACE]);
+      keys.set(controls.readKeys());
+
+      FrameView frame;
+      if (frames.consume(frame))
+        gpu.render(frame);
+      gpu.present();
+
+      if (presentMode != PRESENT_VSYNC)
+        pacer.wait();
     }
 
-    // Emulate one cycle
-    running = chip8.emulateCycle();
-    if (!running){
-      gpu.shutdown();
-      chip8.shutdown();
+    stop.store(true);
+    worker.join();
+  } else {
+    FramePacer pacer;
+    bool running = true;
+    while (running && !quit)
+    {
+      // Check for an SDL quit event
+      while(!headless && SDL_PollEvent(&e) != 0)
+      {
+        //User requests quit
+        if(e.type == SDL_QUIT)
+          quit = true;
+        if (stateCommand(e) == STATE_SAVE)
+          saveStateFile(chip8, statePath);
+        else if (stateCommand(e) == STATE_LOAD && timeTravel)
+          loadStateFile(chip8, statePath);
+        controls.handleEvent(e);
+      }
+
+      // Holding backspace steps back a frame at a time instead of running
+      if (!headless && timeTravel &&
+          SDL_GetKeyboardState(NULL)[SDL_SCANCODE_BACKSPACE]){
+        rewind.pop(chip8);
+      } else {
+        running = runFrame();
+        if (!headless)
+          rewind.push(chip8);
+      }
+
+      // If the draw flag is set, update the screen
+      if(chip8.drawFlag)
+        video->render(chip8.getFrame());
+      video->present();
+
+      if (statsRequested){
+        statsRequested = 0;
+        stats.presentedFrames = gpu.presentedFrames();
+        stats.report(stdout);
+      }
+
+      // If nothing can happen until a key is pressed (or ever), sleep until
+      // there's an event instead of running frames that change nothing.
+      // Otherwise keep to the frame rate, unless running unthrottled (as
+      // headless runs always do) or vsync already paces presenting
+      WaitState wait = chip8.waitState();
+      if (!headless && (wait == WAIT_KEY || wait == WAIT_FOREVER))
+        SDL_WaitEventTimeout(NULL, 500);
+      else if (!unthrottled && presentMode != PRESENT_VSYNC)
+        pacer.wait();
     }
+  }
 
-    // If the draw flag is set, update the screen
-    if(chip8.drawFlag)
-      chip8.render(gpu);
- 
-    // Store key press state (Press and Release)
-    chip8.setKeys();
-
-    // cap operations per second
-    //    SDL_Delay only delays by integer milliseconds, so this won't be too
-    //    precise, but it will at least rate-limit it somewhat
-    frameTime = SDL_GetTicks() - tStart;
-    if (frameTime < 1000/hz) {
-      SDL_Delay((1000/hz) - frameTime);
+  if (scheduler.stuck)
+    printf("Program stopped in a jump to itself with the timers stopped\n");
+  if (chip8.fault() != FAULT_NONE)
+    printf("Program stopped at 0x%03X: %s\n", chip8.faultAddress(),
+      faultName(chip8.fault()));
+
+  if (showStats){
+    stats.presentedFrames = gpu.presentedFrames();
+    stats.report(stdout);
+  }
+
+  if (headless){
+    printf("Stopped after %llu cycles\n", scheduler.totalCycles);
+    chip8.debugRender();
+  } else {
+    controls.shutdown();
+    beeper.shutdown();
+    gpu.shutdown();
+  }
+
+  if (recordPath != NULL && recorder.save(recordPath, seed, hz, quirks,
+      scheduler.totalCycles, chip8.screenHash()))
+    printf("Recorded input to '%s'\n", recordPath);
+
+  if (profilePath != NULL && profiler.save(profilePath))
+    printf("Wrote %llu samples to '%s'\n", profiler.samples(), profilePath);
+
+  if (replayPath != NULL && replay.hasEnd){
+    if (scheduler.totalCycles != replay.endCycle ||
+        chip8.screenHash() != replay.endHash){
+      printf("Replay doesn't match the recording: screen %016llx after %llu "
+        "cycles, expected %016llx after %llu\n",
+        (unsigned long long)chip8.screenHash(), scheduler.totalCycles,
+        (unsigned long long)replay.endHash, replay.endCycle);
+      std::exit(1);
     }
+    printf("Replay matches the recording\n");
   }
- 
+  chip8.shutdown();
+
   return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,21 @@
+#include "pixels.h"
+
+// ARGB for each pixel colour (plane 0 bit + 2 * plane 1 bit). Plain chip8
+// programs only use the first two
+static const uint32_t palette[4] = { 0xFFFFFFFF, 0, 0xFF808080, 0xFF404040 };
+
+void framePixels(const uint64_t * const planes[2], unsigned int width,
+    unsigned int first, unsigned int last, uint32_t * out, int pitch){
+  for(unsigned int y = first; y <= last; y++){
+    uint32_t * pixel = (uint32_t *)((unsigned char *)out + (y - first) * pitch);
+    for(unsigned int w = 0; w < width / 64; w++){
+      uint64_t low = planes[0][2 * y + w];
+      uint64_t high = planes[1][2 * y + w];
+      for(unsigned int x = 0; x < 64; x++){
+        *pixel++ = palette[(low >> 63) | (high >> 63) << 1];
+        low <<= 1;
+        high <<= 1;
+      }
+    }
+  }
+};
@@ -0,0 +1,13 @@
+#ifndef PIXELS_H
+#define PIXELS_H
+
+#include <stdint.h>     // uint32_t, uint64_t
+
+// Converts rows first to last (inclusive) of a framebuffer laid out as in
+// FrameView (planes[p][2 * y + w]) to 32 bit ARGB, width pixels across.
+// Row first goes at out and each row after it pitch bytes further on. Kept
+// apart from the Gpu so it can be benchmarked without SDL
+void framePixels(const uint64_t * const planes[2], unsigned int width,
+  unsigned int first, unsigned int last, uint32_t * out, int pitch);
+
+#endif
@@ -0,0 +1,444 @@
+#include "chip8.h"
+#include "jit.h"
+
+/* The cached engine. Instead of fetching two bytes and walking the opcode
+   switch for every instruction, each address is decoded once into an
+   Instruction holding the handler to run plus its operands (X, Y, N, NN and
+   NNN). Running an instruction is then a single indirect call.
+
+   Records start out (and are reset by invalidate() to) the decode handler,
+   which decodes the instruction at that address, stores the record and runs
+   it. FX33/FX55 and loadGame invalidate the addresses they write to, so
+   programs that modify their own code still behave.
+
+   Handlers for instructions that depend on the quirk profile are compiled
+   once per profile, and the decoder for the profile picks between them */
+
+struct Ops
+{
+  template <QuirkProfile P>
+  static void decode(Chip8 & c, const Instruction & in);
+
+  // Anything rare or unknown goes back through the interpreter
+  static void interpret(Chip8 & c, const Instruction & in);
+
+  static void cls(Chip8 & c, const Instruction & in);
+  static void ret(Chip8 & c, const Instruction & in);
+  static void jump(Chip8 & c, const Instruction & in);
+  static void call(Chip8 & c, const Instruction & in);
+  template <QuirkProfile P>
+  static void skipEqual(Chip8 & c, const Instruction & in);
+  template <QuirkProfile P>
+  static void skipNotEqual(Chip8 & c, const Instruction & in);
+  template <QuirkProfile P>
+  static void skipEqualReg(Chip8 & c, const Instruction & in);
+  static void load(Chip8 & c, const Instruction & in);
+  static void add(Chip8 & c, const Instruction & in);
+  static void move(Chip8 & c, const Instruction & in);
+  template <QuirkProfile P>
+  static void bitOr(Chip8 & c, const Instruction & in);
+  template <QuirkProfile P>
+  static void bitAnd(Chip8 & c, const Instruction & in);
+  template <QuirkProfile P>
+  static void bitXor(Chip8 & c, const Instruction & in);
+  static void addReg(Chip8 & c, const Instruction & in);
+  static void sub(Chip8 & c, const Instruction & in);
+  template <QuirkProfile P>
+  static void shiftRight(Chip8 & c, const Instruction & in);
+  static void subReverse(Chip8 & c, const Instruction & in);
+  template <QuirkProfile P>
+  static void shiftLeft(Chip8 & c, const Instruction & in);
+  template <QuirkProfile P>
+  static void skipNotEqualReg(Chip8 & c, const Instruction & in);
+  static void loadIndex(Chip8 & c, const Instruction & in);
+  template <QuirkProfile P>
+  static void jumpOffset(Chip8 & c, const Instruction & in);
+  static void random(Chip8 & c, const Instruction & in);
+  template <QuirkProfile P>
+  static void draw(Chip8 & c, const Instruction & in);
+  template <QuirkProfile P>
+  static void skipKey(Chip8 & c, const Instruction & in);
+  template <QuirkProfile P>
+  static void skipNotKey(Chip8 & c, const Instruction & in);
+  static void readDelay(Chip8 & c, const Instruction & in);
+  static void waitKey(Chip8 & c, const Instruction & in);
+  static void setDelay(Chip8 & c, const Instruction & in);
+  static void setSound(Chip8 & c, const Instruction & in);
+  static void addIndex(Chip8 & c, const Instruction & in);
+  static void font(Chip8 & c, const Instruction & in);
+  static void bcd(Chip8 & c, const Instruction & in);
+  template <QuirkProfile P>
+  static void store(Chip8 & c, const Instruction & in);
+  template <QuirkProfile P>
+  static void fill(Chip8 & c, const Instruction & in);
+
+  typedef void (*Handler)(Chip8 & c, const Instruction & in);
+  template <QuirkProfile P>
+  static Handler lookup(unsigned short opcode);
+};
+
+template <QuirkProfile P>
+Ops::Handler Ops::lookup(unsigned short opcode){
+  switch(opcode & 0xF000){
+    case 0x0000:
+      if (opcode == 0x00E0) return cls;
+      if (opcode == 0x00EE) return ret;
+      return interpret;
+    case 0x1000: return jump;
+    case 0x2000: return call;
+    case 0x3000: return skipEqual<P>;
+    case 0x4000: return skipNotEqual<P>;
+    case 0x5000:
+      return (opcode & 0x000F) == 0 ? skipEqualReg<P> : interpret;
+    case 0x6000: return load;
+    case 0x7000: return add;
+    case 0x8000:
+      switch (opcode & 0x000F){
+        case 0x0: return move;
+        case 0x1: return bitOr<P>;
+        case 0x2: return bitAnd<P>;
+        case 0x3: return bitXor<P>;
+        case 0x4: return addReg;
+        case 0x5: return sub;
+        case 0x6: return shiftRight<P>;
+        case 0x7: return subReverse;
+        case 0xE: return shiftLeft<P>;
+      }
+      return interpret;
+    case 0x9000:
+      return (opcode & 0x000F) == 0 ? skipNotEqualReg<P> : interpret;
+    case 0xA000: return loadIndex;
+    case 0xB000: return jumpOffset<P>;
+    case 0xC000: return random;
+    case 0xD000: return draw<P>;
+    case 0xE000:
+      if ((opcode & 0x00FF) == 0x9E) return skipKey<P>;
+      if ((opcode & 0x00FF) == 0xA1) return skipNotKey<P>;
+      return interpret;
+    case 0xF000:
+      switch (opcode & 0x00FF){
+        case 0x07: return readDelay;
+        case 0x0A: return waitKey;
+        case 0x15: return setDelay;
+        case 0x18: return setSound;
+        case 0x1E: return addIndex;
+        case 0x29: return font;
+        case 0x33: return bcd;
+        case 0x55: return store<P>;
+        case 0x65: return fill<P>;
+      }
+      return interpret;
+  }
+  return interpret;
+};
+
+template <QuirkProfile P>
+void Ops::decode(Chip8 & c, const Instruction & in){
+  unsigned short address = (&in - c.decoded) + 0x200;
+  unsigned short opcode = c.memory[address] << 8 | c.memory[address + 1];
+
+  Instruction & out = c.decoded[address - 0x200];
+  out.handler = lookup<P>(opcode);
+  out.opcode = opcode;
+  out.nnn = opcode & 0x0FFF;
+  out.x = (opcode & 0x0F00) >> 8;
+  out.y = (opcode & 0x00F0) >> 4;
+  out.n = opcode & 0x000F;
+  out.nn = opcode & 0x00FF;
+
+  out.handler(c, out);
+};
+
+void Chip8::invalidate(unsigned short address, unsigned short length){
+  // The instruction starting one byte before the write overlaps it too
+  unsigned int first = address > 0x200 ? address - 1 : 0x200;
+  unsigned int last = address + length;
+  if (last > 0xFFF)
+    last = 0xFFF;
+  for (unsigned int a = first; a < last; a++)
+    decoded[a - 0x200].handler = decoder;
+
+  // Writes can wrap around the end of memory
+  if (length > 0){
+    unsigned int end = (address + length - 1) >> 8;
+    for (unsigned int page = address >> 8; page <= end; page++)
+      writtenPages[(page & 0xFF) >> 6] |= 1ULL << (page & 63);
+  }
+
+  if (jit)
+    jit->invalidate(address, length);
+};
+
+void Chip8::selectDecoder(){
+  static const Ops::Handler decoders[QUIRK_PROFILES] = {
+    Ops::decode<QUIRKS_DEFAULT>,
+    Ops::decode<QUIRKS_VIP>,
+    Ops::decode<QUIRKS_CHIP48>,
+    Ops::decode<QUIRKS_SCHIP>,
+    Ops::decode<QUIRKS_XOCHIP>
+  };
+  decoder = decoders[quirks];
+  invalidate(0, 0x1000);
+};
+
+unsigned int Chip8::runCached(unsigned int cycles){
+  for (unsigned int i = 0; i < cycles; i++){
+    // Instructions outside the program area (e.g. in the interpreter's
+    // reserved memory) are rare enough to just interpret
+    if (pc < 0x200 || pc >= 0xFFF){
+      if (!emulateCycle())
+        return i;
+      continue;
+    }
+
+    const Instruction & in = decoded[pc - 0x200];
+    in.handler(*this, in);
+    if (exited)
+      return i;
+  }
+  return cycles;
+};
+
+void Ops::interpret(Chip8 & c, const Instruction &){
+  c.emulateCycle();
+};
+
+void Ops::cls(Chip8 & c, const Instruction &){
+  c.clearScreen();
+  c.pc += 2;
+};
+
+void Ops::ret(Chip8 & c, const Instruction &){
+  if (c.sp == 0 || c.sp > 16){
+    c.stop(FAULT_STACK_UNDERFLOW);
+    return;
+  }
+  c.sp--;
+  c.pc = c.stack[c.sp] + 2;
+};
+
+void Ops::jump(Chip8 & c, const Instruction & in){
+  c.pc = in.nnn;
+};
+
+void Ops::call(Chip8 & c, const Instruction & in){
+  if (c.sp >= 16){
+    c.stop(FAULT_STACK_OVERFLOW);
+    return;
+  }
+  c.stack[c.sp] = c.pc;
+  c.sp++;
+  c.pc = in.nnn;
+};
+
+// Skips go through skipNext(), since the instruction skipped over can be
+// four bytes long in XO-CHIP
+template <QuirkProfile P>
+void Ops::skipEqual(Chip8 & c, const Instruction & in){
+  if (c.V[in.x] == in.nn)
+    c.skipNext<P>();
+  else
+    c.pc += 2;
+};
+
+template <QuirkProfile P>
+void Ops::skipNotEqual(Chip8 & c, const Instruction & in){
+  if (c.V[in.x] != in.nn)
+    c.skipNext<P>();
+  else
+    c.pc += 2;
+};
+
+template <QuirkProfile P>
+void Ops::skipEqualReg(Chip8 & c, const Instruction & in){
+  if (c.V[in.x] == c.V[in.y])
+    c.skipNext<P>();
+  else
+    c.pc += 2;
+};
+
+void Ops::load(Chip8 & c, const Instruction & in){
+  c.V[in.x] = in.nn;
+  c.pc += 2;
+};
+
+void Ops::add(Chip8 & c, const Instruction & in){
+  c.V[in.x] += in.nn;
+  c.pc += 2;
+};
+
+void Ops::move(Chip8 & c, const Instruction & in){
+  c.V[in.x] = c.V[in.y];
+  c.pc += 2;
+};
+
+template <QuirkProfile P>
+void Ops::bitOr(Chip8 & c, const Instruction & in){
+  c.V[in.x] |= c.V[in.y];
+  if (quirksOf(P).logicResetsVF)
+    c.V[0xF] = 0;
+  c.pc += 2;
+};
+
+template <QuirkProfile P>
+void Ops::bitAnd(Chip8 & c, const Instruction & in){
+  c.V[in.x] &= c.V[in.y];
+  if (quirksOf(P).logicResetsVF)
+    c.V[0xF] = 0;
+  c.pc += 2;
+};
+
+template <QuirkProfile P>
+void Ops::bitXor(Chip8 & c, const Instruction & in){
+  c.V[in.x] ^= c.V[in.y];
+  if (quirksOf(P).logicResetsVF)
+    c.V[0xF] = 0;
+  c.pc += 2;
+};
+
+void Ops::addReg(Chip8 & c, const Instruction & in){
+  // Same order as the interpreter, so VX or VY being VF behaves the same
+  c.V[0xF] = c.V[in.y] > 0xFF - c.V[in.x];
+  c.V[in.x] += c.V[in.y];
+  c.pc += 2;
+};
+
+void Ops::sub(Chip8 & c, const Instruction & in){
+  c.V[0xF] = c.V[in.y] <= c.V[in.x];
+  c.V[in.x] -= c.V[in.y];
+  c.pc += 2;
+};
+
+// The shifted value is read first and VF written last, as in the interpreter
+template <QuirkProfile P>
+void Ops::shiftRight(Chip8 & c, const Instruction & in){
+  unsigned char source = c.V[quirksOf(P).shiftVY ? in.y : in.x];
+  c.V[in.x] = source >> 1;
+  c.V[0xF] = source & 1;
+  c.pc += 2;
+};
+
+void Ops::subReverse(Chip8 & c, const Instruction & in){
+  c.V[0xF] = c.V[in.y] >= c.V[in.x];
+  c.V[in.x] = c.V[in.y] - c.V[in.x];
+  c.pc += 2;
+};
+
+template <QuirkProfile P>
+void Ops::shiftLeft(Chip8 & c, const Instruction & in){
+  unsigned char source = c.V[quirksOf(P).shiftVY ? in.y : in.x];
+  c.V[in.x] = source << 1;
+  c.V[0xF] = source >> 7;
+  c.pc += 2;
+};
+
+template <QuirkProfile P>
+void Ops::skipNotEqualReg(Chip8 & c, const Instruction & in){
+  if (c.V[in.x] != c.V[in.y])
+    c.skipNext<P>();
+  else
+    c.pc += 2;
+};
+
+void Ops::loadIndex(Chip8 & c, const Instruction & in){
+  c.I = in.nnn;
+  c.pc += 2;
+};
+
+template <QuirkProfile P>
+void Ops::jumpOffset(Chip8 & c, const Instruction & in){
+  c.pc = in.nnn + c.V[quirksOf(P).jumpVX ? in.x : 0];
+};
+
+void Ops::random(Chip8 & c, const Instruction & in){
+  c.V[in.x] = c.nextRandom() & in.nn;
+  c.pc += 2;
+};
+
+template <QuirkProfile P>
+void Ops::draw(Chip8 & c, const Instruction & in){
+  c.drawSprite<P>(c.V[in.x], c.V[in.y], in.n);
+  c.pc += 2;
+};
+
+template <QuirkProfile P>
+void Ops::skipKey(Chip8 & c, const Instruction & in){
+  if (c.keyHeld(c.V[in.x]))
+    c.skipNext<P>();
+  else
+    c.pc += 2;
+};
+
+template <QuirkProfile P>
+void Ops::skipNotKey(Chip8 & c, const Instruction & in){
+  if (!c.keyHeld(c.V[in.x]))
+    c.skipNext<P>();
+  else
+    c.pc += 2;
+};
+
+void Ops::readDelay(Chip8 & c, const Instruction & in){
+  c.V[in.x] = c.delay_timer;
+  c.pc += 2;
+};
+
+void Ops::waitKey(Chip8 & c, const Instruction & in){
+  for (unsigned char i = 0; i < 16; i++){
+    if (c.keyHeld(i)){
+      c.V[in.x] = i;
+      c.pc += 2;
+      return;
+    }
+  }
+};
+
+void Ops::setDelay(Chip8 & c, const Instruction & in){
+  c.delay_timer = c.V[in.x];
+  c.pc += 2;
+};
+
+void Ops::setSound(Chip8 & c, const Instruction & in){
+  c.sound_timer = c.V[in.x];
+  c.pc += 2;
+};
+
+void Ops::addIndex(Chip8 & c, const Instruction & in){
+  c.I += c.V[in.x];
+  c.pc += 2;
+};
+
+void Ops::font(Chip8 & c, const Instruction & in){
+  c.I = c.V[in.x] * 5;
+  c.pc += 2;
+};
+
+void Ops::bcd(Chip8 & c, const Instruction & in){
+  unsigned char value = c.V[in.x];
+  c.memory[c.I] = value / 100;
+  c.memory[(c.I + 1) & 0xFFFF] = (value / 10) % 10;
+  c.memory[(c.I + 2) & 0xFFFF] = value % 10;
+  c.pc += 2;
+  c.invalidate(c.I, 3);
+};
+
+template <QuirkProfile P>
+void Ops::store(Chip8 & c, const Instruction & in){
+  unsigned char last = in.x;
+  for (unsigned char i = 0; i <= last; i++){
+    c.memory[(c.I + i) & 0xFFFF] = c.V[i];
+  }
+  c.pc += 2;
+  c.invalidate(c.I, last + 1);
+  if (quirksOf(P).index != INDEX_KEEP)
+    c.I += last + (quirksOf(P).index == INDEX_PLUS_X_PLUS_1);
+};
+
+template <QuirkProfile P>
+void Ops::fill(Chip8 & c, const Instruction & in){
+  for (unsigned char i = 0; i <= in.x; i++){
+    c.V[i] = c.memory[(c.I + i) & 0xFFFF];
+  }
+  c.pc += 2;
+  if (quirksOf(P).index != INDEX_KEEP)
+    c.I += in.x + (quirksOf(P).index == INDEX_PLUS_X_PLUS_1);
+};
@@ -0,0 +1,134 @@
+#include "profiler.h"
+#include "chip8.h"
+#include <algorithm>    // equal
+#include <fstream>
+#include <sstream>
+#include <stdio.h>      // printf, snprintf
+
+Profiler::Profiler(unsigned int interval)
+  : interval(interval > 0 ? interval : 1), rngState(0x9E3779B97F4A7C15ULL),
+    total(0){
+  countdown = nextGap();
+};
+
+// Somewhere from 1 to 2 * interval - 1 cycles, so interval on average. Has
+// its own generator, so the program's random numbers aren't touched
+unsigned int Profiler::nextGap(){
+  rngState ^= rngState >> 12;
+  rngState ^= rngState << 25;
+  rngState ^= rngState >> 27;
+  uint64_t r = (rngState * 0x2545F4914F6CDD1DULL) >> 32;
+  return 1 + r % (2 * interval - 1);
+};
+
+bool Profiler::loadLabels(const string & path){
+  ifstream file(path);
+  if (!file.is_open()){
+    printf("Could not open labels '%s'\n", path.c_str());
+    return false;
+  }
+
+  map<unsigned short, string> newLabels;
+  string line;
+  for (int number = 1; getline(file, line); number++){
+    size_t comment = line.find('#');
+    if (comment != string::npos)
+      line.erase(comment);
+
+    istringstream fields(line);
+    unsigned int address;
+    string label;
+    if (!(fields >> hex >> address)){
+      continue; // blank line
+    }
+    if (address > 0xFFFF || !(fields >> label)){
+      printf("%s:%i: expected '<hex address> <name>'\n", path.c_str(),
+        number);
+      return false;
+    }
+    newLabels[address] = label;
+  }
+
+  labels = newLabels;
+  return true;
+};
+
+bool Profiler::Stack::operator==(const Stack & other) const{
+  return depth == other.depth &&
+    equal(frames, frames + depth, other.frames);
+};
+
+// 64 bit FNV-1a over the entries in use
+size_t Profiler::StackHash::operator()(const Stack & stack) const{
+  uint64_t hash = 0xCBF29CE484222325ULL;
+  for (unsigned char i = 0; i < stack.depth; i++){
+    hash = (hash ^ (stack.frames[i] & 0xFF)) * 0x100000001B3ULL;
+    hash = (hash ^ (stack.frames[i] >> 8)) * 0x100000001B3ULL;
+  }
+  return hash;
+};
+
+void Profiler::advance(const Chip8 & chip8, unsigned int cycles){
+  if (cycles < countdown){
+    countdown -= cycles;
+    return;
+  }
+  countdown = nextGap();
+
+  // Each return address on the stack is a 2NNN, and NNN is the subroutine.
+  // Only the 16 entries there are get looked at, however deep a runaway
+  // program has called
+  Stack stack;
+  stack.depth = chip8.sp < 16 ? chip8.sp : 16;
+  for (unsigned char i = 0; i < stack.depth; i++){
+    unsigned short call = chip8.stack[i];
+    stack.frames[i] = (chip8.memory[call] & 0x0F) << 8 |
+      chip8.memory[(call + 1) & 0xFFFF];
+  }
+  stack.frames[stack.depth++] = chip8.pc;
+  stacks[stack]++;
+  total++;
+};
+
+string Profiler::name(unsigned short address, bool nearest) const{
+  map<unsigned short, string>::const_iterator label =
+    labels.upper_bound(address);
+  if (label != labels.begin()){
+    --label;
+    if (label->first == address || nearest)
+      return label->second;
+  }
+  char hexAddress[8];
+  snprintf(hexAddress, sizeof(hexAddress), "0x%03X", address);
+  return hexAddress;
+};
+
+bool Profiler::save(const string & path) const{
+  // Stacks that differ only in where pc was can end up with the same names
+  map<string, unsigned long long> folded;
+  unordered_map<Stack, unsigned long long, StackHash>::const_iterator sample;
+  for (sample = stacks.begin(); sample != stacks.end(); ++sample){
+    const Stack & stack = sample->first;
+    string frames = name(0x200, false);
+    string innermost = frames;
+    for (unsigned char i = 0; i + 1 < stack.depth; i++){
+      innermost = name(stack.frames[i], false);
+      frames += ";" + innermost;
+    }
+    // pc is left out if it's just the subroutine's own label again
+    string here = name(stack.frames[stack.depth - 1], true);
+    if (here != innermost)
+      frames += ";" + here;
+    folded[frames] += sample->second;
+  }
+
+  ofstream file(path, ios::out|ios::trunc);
+  map<string, unsigned long long>::const_iterator line;
+  for (line = folded.begin(); line != folded.end(); ++line)
+    file << line->first << " " << line->second << "\n";
+  if (!file.good()){
+    printf("Could not write profile '%s'\n", path.c_str());
+    return false;
+  }
+  return true;
+};
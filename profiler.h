@@ -0,0 +1,79 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <map>
+#include <stdint.h>     // uint64_t
+#include <string>
+#include <unordered_map>
+using namespace std;
+
+class Chip8;
+
+/* Samples the program's call stack (the subroutines entered with 2NNN and
+   not yet returned from, plus pc) every so many emulated cycles, to show
+   which subroutines the program spends its time in. The gaps between samples
+   vary at random around the interval, so loops can't line up with them.
+
+   Samples are taken between batches, which the machine splits at each sample
+   point (see Chip8::attachProfiler). That doesn't change what the program
+   does, and any engine can be used, so a profiled run behaves and times
+   exactly like any other.
+
+   Labels give addresses names. A label file has one "<hex address> <name>"
+   per line, and anything after a '#' is a comment, e.g.
+
+     200 main
+     2A0 drawPlayer
+     2B6 drawPlayer.loop
+
+   Subroutines are named by their address, or the label there, and pc by the
+   nearest label at or before it. save() writes one line per distinct stack
+   in the "folded" format flame graph tools read, outermost first:
+
+     main;drawPlayer;drawPlayer.loop 1234
+*/
+class Profiler
+{
+public:
+  explicit Profiler(unsigned int interval = 100);
+
+  // Prints an error and returns false if the file can't be read
+  bool loadLabels(const string & path);
+
+  // Cycles left until the next sample
+  unsigned int untilSample() const { return countdown; }
+  // Called by the machine after running some cycles; samples its stack if
+  // that reaches the next sample point
+  void advance(const Chip8 & chip8, unsigned int cycles);
+
+  unsigned long long samples() const { return total; }
+  // Prints an error and returns false if the file can't be written
+  bool save(const string & path) const;
+
+private:
+  unsigned int interval;
+  unsigned int countdown;
+  uint64_t rngState;
+  unsigned int nextGap();
+
+  // A sampled stack: the subroutine addresses, outermost first, then pc.
+  // Fixed size, so taking a sample never allocates unless the stack is new
+  struct Stack
+  {
+    unsigned char depth;          // entries used, including pc
+    unsigned short frames[17];
+
+    bool operator==(const Stack & other) const;
+  };
+  struct StackHash
+  {
+    size_t operator()(const Stack & stack) const;
+  };
+  unordered_map<Stack, unsigned long long, StackHash> stacks;
+  unsigned long long total;
+
+  map<unsigned short, string> labels;
+  string name(unsigned short address, bool nearest) const;
+};
+
+#endif
@@ -0,0 +1,20 @@
+#include "quirks.h"
+
+static const char * const profileNames[QUIRK_PROFILES] =
+{
+  "default", "vip", "chip48", "schip", "xochip"
+};
+
+const char * quirkProfileName(QuirkProfile profile){
+  return profile < QUIRK_PROFILES ? profileNames[profile] : "unknown";
+};
+
+bool quirkProfileFromName(const std::string & name, QuirkProfile & profile){
+  for (int i = 0; i < QUIRK_PROFILES; i++){
+    if (name == profileNames[i]){
+      profile = (QuirkProfile)i;
+      return true;
+    }
+  }
+  return false;
+};
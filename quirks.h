@@ -0,0 +1,70 @@
+#ifndef QUIRKS_H
+#define QUIRKS_H
+
+#include <string>
+
+/* chip8 was never standardized, and the interpreters that followed the
+   COSMAC VIP's changed a few instructions' behaviour. Roms are written for
+   one of them, so the machine can be set up to behave like each.
+
+   Every profile is compiled into its own interpreter (and cached engine
+   handlers), with quirksOf() evaluated at compile time, so the checks below
+   fold away rather than being made for every instruction */
+
+// Named sets of quirks
+enum QuirkProfile
+{
+  QUIRKS_DEFAULT, // what this emulator has always done (none of the below)
+  QUIRKS_VIP,     // the original COSMAC VIP interpreter
+  QUIRKS_CHIP48,  // CHIP-48 on the HP-48
+  QUIRKS_SCHIP,   // SUPER-CHIP 1.1
+  QUIRKS_XOCHIP,  // XO-CHIP (Octo)
+  QUIRK_PROFILES  // number of profiles
+};
+
+// Where FX55/FX65 leave I
+enum IndexQuirk
+{
+  INDEX_KEEP,         // unchanged
+  INDEX_PLUS_X,       // I + X (CHIP-48)
+  INDEX_PLUS_X_PLUS_1 // just past VX's byte (VIP, XO-CHIP)
+};
+
+struct Quirks
+{
+  // 8XY6/8XYE shift VY into VX, rather than shifting VX in place
+  bool shiftVY;
+  IndexQuirk index;
+  // BXNN jumps to XNN + VX, rather than BNNN jumping to NNN + V0
+  bool jumpVX;
+  // sprites are cut off at the right and bottom edges rather than wrapping
+  // (where they start still wraps)
+  bool clipSprites;
+  // 8XY1/8XY2/8XY3 set VF to 0
+  bool logicResetsVF;
+  // in high-res mode, DXYN sets VF to the number of sprite rows that hit
+  // something or went off the bottom, rather than just 0 or 1
+  bool countCollisions;
+  // F000 NNNN loads a 16 bit address into I, and skips step over all four
+  // bytes of it, rather than F000 being an unknown opcode
+  bool longLoad;
+};
+
+constexpr Quirks quirksOf(QuirkProfile profile){
+  return profile == QUIRKS_VIP ?
+      Quirks{ true, INDEX_PLUS_X_PLUS_1, false, true, true, false, false } :
+    profile == QUIRKS_CHIP48 ?
+      Quirks{ false, INDEX_PLUS_X, true, true, false, false, false } :
+    profile == QUIRKS_SCHIP ?
+      Quirks{ false, INDEX_KEEP, true, true, false, true, false } :
+    profile == QUIRKS_XOCHIP ?
+      Quirks{ true, INDEX_PLUS_X_PLUS_1, false, false, false, false, true } :
+      Quirks{ false, INDEX_KEEP, false, false, false, false, false };
+}
+
+// "default", "vip", "chip48", "schip" or "xochip"
+const char * quirkProfileName(QuirkProfile profile);
+// Returns false if there's no profile with that name
+bool quirkProfileFromName(const std::string & name, QuirkProfile & profile);
+
+#endif
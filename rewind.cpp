@@ -0,0 +1,127 @@
+#include "rewind.h"
+
+Rewind::Rewind(unsigned int maxFrames, unsigned int keyframeInterval)
+  : maxFrames(maxFrames), keyframeInterval(keyframeInterval),
+    sinceKey(keyframeInterval){
+};
+
+void Rewind::push(Chip8 & chip8){
+  chip8.saveState(state);
+
+  Entry entry;
+  entry.keyframe = sinceKey >= keyframeInterval || state.size() != key.size();
+  if (entry.keyframe){
+    entry.size = encode(std::vector<unsigned char>());
+    key = state;
+    sinceKey = 0;
+  } else {
+    entry.size = encode(key);
+  }
+  entries.push_back(entry);
+  sinceKey++;
+
+  // Drop the oldest keyframe along with the frames that depend on it, as
+  // long as there's a newer one to keep going from
+  while (entries.size() > maxFrames){
+    size_t next = 1;
+    while (next < entries.size() && !entries[next].keyframe)
+      next++;
+    if (next == entries.size())
+      break;
+
+    size_t length = 0;
+    for (size_t i = 0; i < next; i++)
+      length += entries[i].size;
+    entries.erase(entries.begin(), entries.begin() + next);
+    data.erase(data.begin(), data.begin() + length);
+  }
+};
+
+bool Rewind::pop(Chip8 & chip8){
+  if (entries.empty())
+    return false;
+
+  // Walk back from the newest frame to the keyframe it depends on
+  size_t newest = entries.size() - 1;
+  size_t offset = data.size() - entries[newest].size;
+  size_t k = newest;
+  size_t keyOffset = offset;
+  while (!entries[k].keyframe){
+    k--;
+    keyOffset -= entries[k].size;
+  }
+
+  decode(keyOffset, std::vector<unsigned char>(), key);
+  if (k == newest)
+    state = key;
+  else
+    decode(offset, key, state);
+  chip8.loadState(state);
+
+  data.erase(data.begin() + offset, data.end());
+  entries.pop_back();
+  // Carry on from the same keyframe, unless that's what was just dropped
+  sinceKey = k == newest ? keyframeInterval : newest - k;
+  return true;
+};
+
+void Rewind::clear(){
+  entries.clear();
+  data.clear();
+  sinceKey = keyframeInterval;
+};
+
+size_t Rewind::bytes() const{
+  return data.size() + entries.size() * sizeof(Entry);
+};
+
+/* Appends state XOR base (or just state, if base is empty) to data: the
+   number of pages that aren't zero, then each of those pages' index followed
+   by its bytes (2 byte counts and indexes, little endian). States are mostly
+   untouched memory, so listing pages beats a bitmask of all of them. Returns
+   the number of bytes added */
+uint32_t Rewind::encode(const std::vector<unsigned char> & base){
+  size_t start = data.size();
+  size_t pages = (state.size() + pageSize - 1) / pageSize;
+  data.resize(start + 2, 0);
+  unsigned int count = 0;
+
+  for (size_t p = 0; p < pages; p++){
+    size_t first = p * pageSize;
+    size_t last = first + pageSize < state.size() ? first + pageSize
+      : state.size();
+
+    bool changed = false;
+    for (size_t i = first; i < last && !changed; i++)
+      changed = state[i] != (base.empty() ? 0 : base[i]);
+    if (!changed)
+      continue;
+
+    count++;
+    data.push_back(p & 0xFF);
+    data.push_back(p >> 8);
+    for (size_t i = first; i < last; i++)
+      data.push_back(state[i] ^ (base.empty() ? 0 : base[i]));
+  }
+  data[start] = count & 0xFF;
+  data[start + 1] = count >> 8;
+  return data.size() - start;
+};
+
+void Rewind::decode(size_t offset, const std::vector<unsigned char> & base,
+    std::vector<unsigned char> & out) const{
+  // Every state is the same size, and a keyframe is always held in key
+  out = base.empty() ? std::vector<unsigned char>(key.size(), 0) : base;
+
+  unsigned int count = data[offset] | data[offset + 1] << 8;
+  size_t in = offset + 2;
+  for (unsigned int n = 0; n < count; n++){
+    size_t p = data[in] | data[in + 1] << 8;
+    in += 2;
+    size_t first = p * pageSize;
+    size_t last = first + pageSize < out.size() ? first + pageSize
+      : out.size();
+    for (size_t i = first; i < last; i++)
+      out[i] ^= data[in++];
+  }
+};
@@ -0,0 +1,58 @@
+#ifndef REWIND_H
+#define REWIND_H
+
+#include "chip8.h"
+#include "scheduler.h"
+#include <deque>
+#include <stdint.h>     // uint32_t
+#include <vector>
+
+// History of save states, one per frame, that can be stepped back through.
+// Every keyframeInterval frames a keyframe is stored; the frames in between
+// are stored as the XOR of their state with that keyframe. Either way only
+// the 16 byte pages that aren't zero are kept, so a frame usually costs a few
+// pages of registers, screen rows and whatever memory the program touched
+class Rewind
+{
+public:
+  // Keeps the last maxFrames frames (rounded to whole keyframe intervals)
+  Rewind(unsigned int maxFrames = 60 * frameRate,
+    unsigned int keyframeInterval = 60);
+
+  // Record the machine's state; call once at the end of every frame
+  void push(Chip8 & chip8);
+
+  // Restore the most recently recorded state and forget it. Returns false if
+  // there's no history left
+  bool pop(Chip8 & chip8);
+
+  void clear();
+  size_t frames() const { return entries.size(); }
+  // memory used by the history itself
+  size_t bytes() const;
+
+private:
+  struct Entry
+  {
+    uint32_t size;
+    bool keyframe;
+  };
+  std::deque<Entry> entries;
+  std::deque<unsigned char> data;
+
+  unsigned int maxFrames;
+  unsigned int keyframeInterval;
+  // frames recorded since (and including) the newest keyframe
+  unsigned int sinceKey;
+
+  // the newest keyframe, and scratch space for the state being stored
+  std::vector<unsigned char> key;
+  std::vector<unsigned char> state;
+
+  static const unsigned int pageSize = 16;
+  uint32_t encode(const std::vector<unsigned char> & base);
+  void decode(size_t offset, const std::vector<unsigned char> & base,
+    std::vector<unsigned char> & out) const;
+};
+
+#endif
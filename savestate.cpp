@@ -0,0 +1,201 @@
+#include "chip8.h"
+#include <algorithm>    // copy, equal
+#include <stdio.h>      // printf
+
+/* Save state format. Everything is little endian, and the layout is fixed for
+   a given version, so blobs from the same version always line up byte for
+   byte (the rewind buffer relies on this to diff them):
+
+   "C8ST", version (1 byte), then
+   memory[65536], gfx (2 planes x 64 rows x 2 words, 8 bytes each), hires,
+   planes, V[16], I, pc, stack[16], sp (2 bytes each), delay timer, sound
+   timer, keypad (2 bytes, bit i for key i), rng seed, rng state (8 bytes
+   each), rpl[16], audio pattern[16], pitch, exited, fault, quirk profile
+
+   A state only loads under the profile it was saved with, as the same
+   program can go a different way under another one
+
+   Anything derived from the above (decoded instructions, translated code,
+   dirty rows) isn't saved, it's rebuilt on load */
+
+static const unsigned char stateMagic[4] = { 'C', '8', 'S', 'T' };
+static const unsigned char stateVersion = 5;
+
+static void put(vector<unsigned char> & out, uint64_t value, int bytes){
+  for (int i = 0; i < bytes; i++)
+    out.push_back((value >> (8 * i)) & 0xFF);
+};
+
+static uint64_t get(const unsigned char * & in, int bytes){
+  uint64_t value = 0;
+  for (int i = 0; i < bytes; i++)
+    value |= (uint64_t)*in++ << (8 * i);
+  return value;
+};
+
+void Chip8::saveState(vector<unsigned char> & state){
+  state.assign(stateMagic, stateMagic + 4);
+  state.push_back(stateVersion);
+
+  state.insert(state.end(), memory, memory + sizeof(memory));
+  for (int p = 0; p < 2; p++){
+    for (unsigned char y = 0; y < 64; y++){
+      put(state, gfx[p][y][0], 8);
+      put(state, gfx[p][y][1], 8);
+    }
+  }
+  state.push_back(hires);
+  state.push_back(planes);
+  state.insert(state.end(), V, V + 16);
+  put(state, I, 2);
+  put(state, pc, 2);
+  for (unsigned char i = 0; i < 16; i++)
+    put(state, stack[i], 2);
+  put(state, sp, 2);
+  state.push_back(delay_timer);
+  state.push_back(sound_timer);
+  put(state, keypad, 2);
+  put(state, rngSeed, 8);
+  put(state, rngState, 8);
+  state.insert(state.end(), rpl, rpl + 16);
+  state.insert(state.end(), audioPattern, audioPattern + 16);
+  state.push_back(pitch);
+  state.push_back(exited);
+  state.push_back(faulted);
+  state.push_back(quirks);
+};
+
+bool Chip8::loadState(const vector<unsigned char> & state){
+  const size_t stackAt = 5 + sizeof(memory) + 2 * 64 * 2 * 8 + 2 + 16 + 2 * 2;
+  const size_t size = stackAt + 16 * 2 + 2 + 2 + 2 + 2 * 8 + 16 + 16 + 4;
+  if (state.size() != size || !equal(stateMagic, stateMagic + 4,
+      state.begin()) || state[4] != stateVersion){
+    printf("Not a save state from this version\n");
+    return false;
+  }
+  // A stack pointer past the end, or an unknown fault, can't be run from
+  const unsigned char * stackPointer = &state[stackAt + 16 * 2];
+  if (get(stackPointer, 2) > 16 || state[size - 2] >= FAULTS ||
+      state[size - 1] >= QUIRK_PROFILES){
+    printf("Save state is corrupt\n");
+    return false;
+  }
+  if (state[size - 1] != quirks){
+    printf("Save state is for the %s quirk profile, not %s\n",
+      quirkProfileName((QuirkProfile)state[size - 1]),
+      quirkProfileName(quirks));
+    return false;
+  }
+
+  const unsigned char * in = &state[5];
+  copy(in, in + sizeof(memory), memory);
+  in += sizeof(memory);
+  for (int p = 0; p < 2; p++){
+    for (unsigned char y = 0; y < 64; y++){
+      gfx[p][y][0] = get(in, 8);
+      gfx[p][y][1] = get(in, 8);
+    }
+  }
+  loadRegisters(in);
+
+  // All of memory may have changed, and the whole screen needs redrawing
+  invalidate(0, 0x1000);
+  fill(writtenPages, writtenPages + 4, ~0ULL);
+  dirtyRows = ~0ULL;
+  drawFlag = true;
+  frameSequence++;
+  setTone(sound_timer > 0);
+  setPattern();
+  return true;
+};
+
+void Chip8::loadRegisters(const unsigned char * in){
+  hires = *in++ != 0;
+  planes = *in++ & 3;
+  copy(in, in + 16, V);
+  in += 16;
+  I = get(in, 2);
+  pc = get(in, 2);
+  for (unsigned char i = 0; i < 16; i++)
+    stack[i] = get(in, 2);
+  sp = get(in, 2);
+  delay_timer = *in++;
+  sound_timer = *in++;
+  keypad = get(in, 2);
+  rngSeed = get(in, 8);
+  rngState = get(in, 8);
+  copy(in, in + 16, rpl);
+  in += 16;
+  copy(in, in + 16, audioPattern);
+  in += 16;
+  pitch = *in++;
+  exited = *in++ != 0;
+  faulted = (Fault)*in++;
+};
+
+void Chip8::takeSnapshot(){
+  saveState(snapshot);
+  copy(&gfx[0][0][0], &gfx[0][0][0] + 2 * 64 * 2, &snapshotScreen[0][0][0]);
+  fill(writtenPages, writtenPages + 4, 0);
+};
+
+bool Chip8::restoreSnapshot(){
+  if (snapshot.empty())
+    return false;
+
+  // Only pages written since need copying back (and decoding again)
+  const unsigned char * saved = &snapshot[5];
+  for (unsigned int page = 0; page < 256; page++){
+    if ((writtenPages[page >> 6] >> (page & 63) & 1) == 0)
+      continue;
+    copy(saved + page * 256, saved + page * 256 + 256, memory + page * 256);
+    invalidate(page * 256, 256);
+  }
+  fill(writtenPages, writtenPages + 4, 0);
+  copy(&snapshotScreen[0][0][0], &snapshotScreen[0][0][0] + 2 * 64 * 2,
+    &gfx[0][0][0]);
+  loadRegisters(saved + sizeof(memory) + sizeof(gfx));
+
+  dirtyRows = ~0ULL;
+  drawFlag = true;
+  frameSequence++;
+  setTone(sound_timer > 0);
+  setPattern();
+  return true;
+};
+
+// 64 bit FNV-1a, like screenHash, over a run of bytes
+static void hashBytes(uint64_t & hash, const void * data, size_t size){
+  const unsigned char * bytes = (const unsigned char *)data;
+  for (size_t i = 0; i < size; i++){
+    hash ^= bytes[i];
+    hash *= 0x100000001B3ULL;
+  }
+};
+
+uint64_t Chip8::machineHash(){
+  uint64_t hash = 0xCBF29CE484222325ULL;
+  hashBytes(hash, V, sizeof(V));
+  hashBytes(hash, &I, sizeof(I));
+  hashBytes(hash, &pc, sizeof(pc));
+  hashBytes(hash, &sp, sizeof(sp));
+  hashBytes(hash, stack, sizeof(stack));
+  hashBytes(hash, &delay_timer, sizeof(delay_timer));
+  hashBytes(hash, &sound_timer, sizeof(sound_timer));
+  hashBytes(hash, &rngState, sizeof(rngState));
+  hashBytes(hash, &hires, sizeof(hires));
+  hashBytes(hash, &planes, sizeof(planes));
+  hashBytes(hash, rpl, sizeof(rpl));
+  hashBytes(hash, audioPattern, sizeof(audioPattern));
+  hashBytes(hash, &pitch, sizeof(pitch));
+  hashBytes(hash, &exited, sizeof(exited));
+  hashBytes(hash, &faulted, sizeof(faulted));
+
+  // Pages no one has written to are still as in the snapshot
+  hashBytes(hash, writtenPages, sizeof(writtenPages));
+  for (unsigned int page = 0; page < 256; page++){
+    if ((writtenPages[page >> 6] >> (page & 63) & 1) != 0)
+      hashBytes(hash, memory + page * 256, 256);
+  }
+  return hash;
+};
@@ -0,0 +1,32 @@
+#include "scheduler.h"
+
+Scheduler::Scheduler(double hz, unsigned long long maxCycles)
+  : totalCycles(0), stuck(false), cyclesPerFrame(hz / frameRate),
+    cycleBudget(0), maxCycles(maxCycles), stopStuck(false){
+};
+
+bool Scheduler::runFrame(Chip8 & chip8, InputSource & input){
+  // Store key press state (Press and Release)
+  chip8.setKeys(input);
+
+  bool more = true;
+  cycleBudget += cyclesPerFrame;
+  unsigned int cycles = (unsigned int)cycleBudget;
+  cycleBudget -= cycles;
+  if (maxCycles != 0 && totalCycles + cycles >= maxCycles){
+    cycles = maxCycles - totalCycles;
+    more = false;
+  }
+
+  unsigned int ran = chip8.run(cycles);
+  totalCycles += ran;
+  if (ran < cycles)
+    more = false;
+
+  chip8.tickTimers();
+  if (more && stopStuck && chip8.waitState() == WAIT_FOREVER){
+    stuck = true;
+    more = false;
+  }
+  return more;
+};
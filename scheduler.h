@@ -0,0 +1,39 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include "chip8.h"
+
+// chip8 programs expect input, timers and the display to update at 60Hz
+const double frameRate = 60;
+
+// Runs the core in batches, one batch per 60Hz frame. The fractional part
+// of hz / frameRate is carried over so e.g. 500Hz averages out to 8.33
+// instructions per frame
+class Scheduler
+{
+public:
+  unsigned long long totalCycles;
+
+  // set once a run has been stopped by stopWhenStuck
+  bool stuck;
+
+  // maxCycles of 0 means no limit
+  Scheduler(double hz, unsigned long long maxCycles);
+
+  // Ends the run once the program is in a jump to itself with the timers
+  // stopped (WAIT_FOREVER), which nothing but loading a state or rewinding
+  // can get it out of, e.g. when running headless with no cycle limit
+  void stopWhenStuck(bool on) { stopStuck = on; }
+
+  // Reads the keys, runs one frame's worth of cycles and ticks the timers.
+  // Returns false once the program has stopped or the cycle limit is hit
+  bool runFrame(Chip8 & chip8, InputSource & input);
+
+private:
+  double cyclesPerFrame;
+  double cycleBudget;
+  unsigned long long maxCycles;
+  bool stopStuck;
+};
+
+#endif
@@ -0,0 +1,634 @@
+// The opcode tests, which reach into the machine. They're only linked into
+// the test binary (see test.cpp), never into the emulator itself
+
+// The tests are asserts, so they have to stay in whatever the build flags
+#undef NDEBUG
+#include "chip8.h"
+#include <cassert>      // assert
+#include <stdio.h>      // printf
+#include <vector>
+using namespace std;
+
+// Remembers the last audio pattern it was told to play
+class PatternSink : public AudioSink
+{
+public:
+  const unsigned char * pattern = NULL;
+  unsigned char pitch = 0;
+
+  void setTone(bool) {}
+  void setPattern(const unsigned char * p, unsigned char n){
+    pattern = p;
+    pitch = n;
+  }
+};
+
+void Chip8::runOpcode(unsigned short op){
+  memory[pc] = (op & 0xFF00) >> 8;
+  memory[pc + 1] = op & 0x00FF;
+  invalidate(pc, 2);
+  run(1);
+};
+
+
+void Chip8::selfTest(){
+  printf("Running unit tests...\n");
+
+  // Every engine has to pass the same tests
+  Engine previous = engine;
+  QuirkProfile previousQuirks = quirks;
+  setEngine(ENGINE_INTERPRETER);
+  runSelfTests();
+  setEngine(ENGINE_CACHED);
+  runSelfTests();
+  setEngine(ENGINE_JIT);
+  runSelfTests();
+  setEngine(previous);
+  setQuirks(previousQuirks);
+
+  printf("Completed successfully\n\n");
+};
+
+
+void Chip8::runSelfTests(){
+
+  // 00EE: Return from subroutine
+  initialize();
+  sp = 5;
+  stack[4] = 0x400;
+  runOpcode(0x00EE);
+  assert(sp == 4);
+  assert(pc == 0x402);
+
+  // 1NNN: Jump to address NNN
+  runOpcode(0x1765);
+  assert(pc == 0x765);
+
+  // 2NNN: Calls subroutine at NNN
+  initialize();
+  runOpcode(0x2345);
+  assert(pc == 0x345);
+  assert(sp == 1);
+  assert(stack[0] == 0x200);
+
+  // 3XNN: Skips the next instruction if VX equals NN
+  initialize();
+  V[5] = 0xDC;
+  runOpcode(0x35DC);
+  assert(pc == 0x204);
+  runOpcode(0x3511);
+  assert(pc == 0x206);
+
+  // 4XNN: Skips the next instruction if VX doesn't equal NN
+  initialize();
+  V[5] = 0xDC;
+  runOpcode(0x45DC);
+  assert(pc == 0x202);
+  runOpcode(0x4511);
+  assert(pc == 0x206);
+
+  // 5XY0: Skips the next instruction if VX equals VY
+  initialize();
+  V[8] = 0xCC; V[6] = 0xBB; V[5] = 0xCC;
+  runOpcode(0x5860);
+  assert(pc == 0x202);
+  runOpcode(0x5580);
+  assert(pc == 0x206);
+  runOpcode(0x5660);
+  assert(pc == 0x20A);
+
+  // 6XNN: Sets VX to NN
+  initialize();
+  runOpcode(0x63BC);
+  assert(V[3] == 0xBC);
+
+  // 7XNN: Adds NN to VX
+  initialize();
+  V[5] = 58;
+  runOpcode(0x75AB);
+  assert(V[5] == 229);
+
+  // 8XY0: Sets the value of VX to the value of VY
+  initialize();
+  V[2] = 0xAF;
+  runOpcode(0x8920);
+  assert(V[9] == 0xAF);
+
+  // 8XY1: Sets VX to VX or VY
+  initialize();
+  V[7] = 0xDE;
+  V[4] = 0x47;
+  runOpcode(0x8741);
+  assert(V[7] == (0xDE | 0x47));
+
+  // 8XY2: Sets VX to VX and VY
+  initialize();
+  V[7] = 0xDE;
+  V[4] = 0x47;
+  runOpcode(0x8742);
+  assert(V[7] == (0xDE & 0x47));
+
+  // 8XY3: Sets VX to VX xor VY
+  initialize();
+  V[7] = 0xDE;
+  V[4] = 0x47;
+  runOpcode(0x8743);
+  assert(V[7] == (0xDE ^ 0x47));
+
+  // 8XY4:  Adds VY to VX. VF is set to 1 when there's a carry, and to 0
+  // when there isn't
+  initialize();
+  V[7] = 128; V[8] = 128;
+  runOpcode(0x8874);
+  assert(V[0xF] == 1);
+  assert(V[8] == 0);
+  V[7] = 79; V[8] = 115;
+  runOpcode(0x8874);
+  assert(V[0xF] == 0);
+  assert(V[8] == 79 + 115);
+
+  // 8XY5: VY is subtracted from VX. VF is set to 0 when there's a borrow,
+  // and 1 when there isn't
+  initialize();
+  V[7] = 128; V[8] = 128;
+  runOpcode(0x8875);
+  assert(V[0xF] == 1);
+  assert(V[8] == 0);
+  V[7] = 200; V[8] = 100;
+  runOpcode(0x8875);
+  assert(V[0xF] == 0);
+  assert(V[8] == 156);
+
+  // 8XY6: Shifts VX right by one. VF is set to the value of the least
+  // significant bit of VX before the shift
+  initialize();
+  V[2] = 0b01010101;
+  runOpcode(0x82F6);
+  assert(V[2] == 0b00101010);
+  assert(V[0xF] == 1);
+  runOpcode(0x82F6);
+  assert(V[2] == 0b00010101);
+  assert(V[0xF] == 0);
+
+  // 8XY7: Sets VX to VY minus VX. VF is set to 0 when there's a borrow, and 1
+  // when there isn't
+  initialize();
+  V[7] = 128; V[8] = 128;
+  runOpcode(0x8877);
+  assert(V[0xF] == 1);
+  assert(V[8] == 0);
+  V[7] = 100; V[8] = 200;
+  runOpcode(0x8877);
+  assert(V[0xF] == 0);
+  assert(V[8] == 156);
+
+  // 8XYE: Shifts VX left by one. VF is set to the value of the most significant
+  // bit of VX before the shift
+  initialize();
+  V[2] = 0b10101010;
+  runOpcode(0x82FE);
+  assert(V[2] == 0b01010100);
+  assert(V[0xF] == 1);
+  runOpcode(0x82FE);
+  assert(V[2] == 0b10101000);
+  assert(V[0xF] == 0);
+
+  // 9XY0: Skips the next instruction if VX doesn't equal VY
+  initialize();
+  V[4] = 34; V[1] = 54;
+  runOpcode(0x9410);
+  assert(pc == 0x204);
+  V[1] = 34;
+  runOpcode(0x9410);
+  assert(pc == 0x206);
+
+  // ANNN: Set I to NNN
+  initialize();
+  runOpcode(0xAABC);
+  assert(I == 0xABC);
+
+  // BNNN: Jumps to the address NNN plus V0
+  V[0] = 0x43;
+  runOpcode(0xB2BB);
+  assert(pc == 0x43 + 0x2BB);
+
+  // CXNN: Sets VX to the result of a bitwise and operation on a random number
+  // and NN
+  initialize();
+  runOpcode(0xC300 | 0b10101010);
+  assert((V[3] & 0b01010101) == 0);
+
+  // CXNN: The same seed always gives the same numbers
+  uint64_t previousSeed = rngSeed;
+  unsigned char first[8];
+  seed(1234);
+  for (int i = 0; i < 8; i++){
+    runOpcode(0xC0FF);
+    first[i] = V[0];
+  }
+  seed(1234);
+  bool different = false;
+  for (int i = 0; i < 8; i++){
+    runOpcode(0xC0FF);
+    assert(V[0] == first[i]);
+    different = different || V[0] != first[0];
+  }
+  assert(different);
+  seed(previousSeed);
+
+  // DXYN: Draws the N row sprite at I to VX, VY, setting VF on collision
+  initialize();
+  I = 0;                     // font "0": F0 90 90 90 F0
+  V[1] = 10; V[2] = 3;
+  runOpcode(0xD125);
+  assert(gfx[0][3][0] == (uint64_t)0xF0 << (56 - 10));
+  assert(gfx[0][4][0] == (uint64_t)0x90 << (56 - 10));
+  assert(V[0xF] == 0);
+  assert(drawFlag);
+  runOpcode(0xD125);         // drawing it again erases it
+  assert(gfx[0][3][0] == 0 && gfx[0][7][0] == 0);
+  assert(V[0xF] == 1);
+
+  // DXYN: Sprites wrap around the right and bottom edges
+  initialize();
+  I = 0;
+  V[1] = 62; V[2] = 30;
+  runOpcode(0xD125);
+  assert(gfx[0][30][0] == ((uint64_t)0x3 | ((uint64_t)0xC << 60)));
+  assert(gfx[0][31][0] == ((uint64_t)0x2 | ((uint64_t)0x4 << 60)));
+  assert(gfx[0][0][0] == gfx[0][31][0] && gfx[0][2][0] == gfx[0][30][0]);
+  assert(gfx[0][3][0] == 0);
+
+  // 00FF: High-res sprites wrap at 128x64, across both words of a row
+  initialize();
+  runOpcode(0x00FF);
+  assert(hires);
+  I = 0;
+  V[1] = 126; V[2] = 62;
+  runOpcode(0xD125);
+  assert(gfx[0][62][1] == 0x3 && gfx[0][62][0] == (uint64_t)0xC << 60);
+  assert(gfx[0][1][1] == 0x2 && gfx[0][1][0] == (uint64_t)0x4 << 60);
+  V[1] = 60;
+  runOpcode(0xD125);         // straddles the two words
+  assert(gfx[0][62][0] == ((uint64_t)0xC << 60 | 0xF) && V[0xF] == 0);
+  runOpcode(0x00FE);         // switching back clears the screen
+  assert(!hires && gfx[0][62][0] == 0 && gfx[0][62][1] == 0);
+
+  // DXY0: Draws a 16x16 sprite, two bytes per row
+  initialize();
+  for (int i = 0; i < 32; i++)
+    memory[0x300 + i] = 0xFF;
+  I = 0x300;
+  V[1] = 8; V[2] = 0;
+  runOpcode(0xD120);
+  assert(gfx[0][0][0] == (uint64_t)0xFFFF << 40 && gfx[0][15][0] == gfx[0][0][0]);
+  assert(gfx[0][16][0] == 0);
+
+  // 00CN, 00FB, 00FC: Scroll down, right and left
+  runOpcode(0x00C3);
+  assert(gfx[0][2][0] == 0 && gfx[0][3][0] == (uint64_t)0xFFFF << 40);
+  assert(gfx[0][18][0] == (uint64_t)0xFFFF << 40 && gfx[0][19][0] == 0);
+  runOpcode(0x00FB);
+  assert(gfx[0][3][0] == (uint64_t)0xFFFF << 36);
+  runOpcode(0x00FC);
+  runOpcode(0x00FC);
+  assert(gfx[0][3][0] == (uint64_t)0xFFFF << 44);
+
+  // FN01: With both planes selected, plane 1's sprite follows plane 0's
+  initialize();
+  memory[0x300] = 0x80; memory[0x301] = 0x40;
+  I = 0x300;
+  V[1] = 0; V[2] = 0;
+  runOpcode(0xF301);
+  runOpcode(0xD121);
+  assert(gfx[0][0][0] == (uint64_t)0x80 << 56 && gfx[1][0][0] == (uint64_t)0x40 << 56);
+  runOpcode(0xF201);
+  runOpcode(0x00E0);         // only clears plane 1
+  assert(gfx[0][0][0] != 0 && gfx[1][0][0] == 0);
+
+  // Skips step over all four bytes of F000 NNNN (XO-CHIP)
+  setQuirks(QUIRKS_XOCHIP);
+  initialize();
+  memory[0x202] = 0xF0; memory[0x203] = 0x00;
+  memory[0x204] = 0x12; memory[0x205] = 0x34;
+  runOpcode(0x3000);
+  assert(pc == 0x206);
+  pc = 0x202;
+  run(1);
+  assert(I == 0x1234 && pc == 0x206);
+  setQuirks(QUIRKS_DEFAULT);
+
+  // F002, FX3A: The audio pattern and its pitch reach the audio sink, which
+  // is told there's none while it's all zeros (XO-CHIP)
+  initialize();
+  PatternSink sink;
+  AudioSink * previousAudio = audio;
+  attachAudio(&sink);
+  assert(sink.pattern == NULL);
+  memory[0x300] = 0xF0;
+  I = 0x300;
+  runOpcode(0xF002);
+  assert(sink.pattern != NULL && sink.pattern[0] == 0xF0 && sink.pitch == 64);
+  V[5] = 112;
+  runOpcode(0xF53A);
+  assert(sink.pitch == 112);
+  initialize();
+  assert(sink.pattern == NULL);
+  attachAudio(previousAudio);
+
+  // 5XY2, 5XY3: Store and fill a range of registers, in either order
+  initialize();
+  I = 0x1000;
+  V[2] = 0xA; V[3] = 0xB; V[4] = 0xC;
+  runOpcode(0x5242);
+  assert(memory[0x1000] == 0xA && memory[0x1002] == 0xC && I == 0x1000);
+  runOpcode(0x5423);
+  assert(V[4] == 0xA && V[3] == 0xB && V[2] == 0xC);
+
+  // 00FD: Stops the program where it is
+  initialize();
+  memory[0x200] = 0x00; memory[0x201] = 0xFD;
+  invalidate(0x200, 2);
+  assert(run(5) == 0 && pc == 0x200);
+
+  // 2NNN and 00EE stop the program rather than go past either end of the
+  // stack, leaving pc on the instruction
+  initialize();
+  sp = 16;
+  runOpcode(0x2400);
+  assert(fault() == FAULT_STACK_OVERFLOW && pc == 0x200 && sp == 16);
+  assert(run(5) == 0 && pc == 0x200);
+  initialize();
+  runOpcode(0x00EE);
+  assert(fault() == FAULT_STACK_UNDERFLOW && pc == 0x200 && sp == 0);
+
+  // EX9E: Skips the next instruction if the key stored in VX is pressed
+  initialize();
+  V[4] = 0xE; keypad = 1 << 0xE;
+  runOpcode(0xE49E);
+  assert(pc == 0x204);
+  keypad = 0;
+  runOpcode(0xE49E);
+  assert(pc == 0x206);
+
+  // EXA1: Skips the next instruction if the key stored in VX isn't pressed
+  initialize();
+  V[4] = 0xE; keypad = 1 << 0xE;
+  runOpcode(0xE4A1);
+  assert(pc == 0x202);
+  keypad = 0;
+  runOpcode(0xE4A1);
+  assert(pc == 0x206);
+
+  // FX07: Sets VX to the value of the delay timer
+  initialize();
+  delay_timer = 120;
+  runOpcode(0xF207);
+  assert(V[2] == 120);
+
+  // FX0A: A key press is awaited, and then stored in VX
+  initialize();
+  runOpcode(0xF60A);
+  assert(pc == 0x200);
+  assert(V[6] == 0);
+  keypad = 1 << 0xC | 1 << 0xD;
+  runOpcode(0xF60A);
+  assert(pc == 0x202);
+  assert(V[6] == 0xC);
+  keypad = 0;
+
+  // FX15: Sets the delay timer to VX
+  initialize();
+  V[8] = 123;
+  runOpcode(0xF815);
+  assert(delay_timer == 123);
+
+  // FX18: Sets the sound timer to VX
+  initialize();
+  V[8] = 123;
+  runOpcode(0xF818);
+  assert(sound_timer == 123);
+
+  // FX1E: Adds VX to I
+  initialize();
+  I = 23; V[5] = 149;
+  runOpcode(0xF51E);
+  assert(I == 23 + 149);
+
+  // FX29: Sets I to the location of the sprite for the character in VX.
+  // Characters 0-F (in hexadecimal) are represented by a 4x5 font
+  initialize();
+  V[7] = 8;
+  runOpcode(0xF729);
+  assert(I == 40);
+
+  // FX33: Stores the Binary-coded decimal representation of VX
+  initialize();
+  I = 0x300;
+  V[5] = 209;
+  runOpcode(0xF533);
+  assert(memory[I] == 2);
+  assert(memory[I + 1] == 0);
+  assert(memory[I + 2] == 9);
+
+  // FX55: Stores V0 to VX (including VX) in memory starting at address I
+  initialize();
+  I = 0x300;
+  V[0] = 0xAB; V[4] = 0xCB; V[5] = 0xDB;
+  runOpcode(0xF455);
+  assert(memory[I] == 0xAB);
+  assert(memory[I + 4] == 0xCB);
+  assert(memory[I + 5] == 0);
+
+  // FX65: Fills V0 to VX (including VX) with values from memory starting
+  // at address I
+  initialize();
+  I = 0x300;
+  memory[I + 0] = 0xAB; memory[I + 4] = 0xCB; memory[I + 5] = 0xDB;
+  runOpcode(0xF465);
+  assert(V[0] == 0xAB);
+  assert(V[4] == 0xCB);
+  assert(V[5] == 0);
+
+  // Instructions written over by FX55 have to be decoded again
+  initialize();
+  memory[0x202] = 0x62; memory[0x203] = 0x11;
+  invalidate(0x202, 2);
+  pc = 0x202;
+  run(1);
+  assert(V[2] == 0x11);
+  I = 0x202;
+  V[0] = 0x62; V[1] = 0x23;
+  pc = 0x200;
+  runOpcode(0xF155);
+  assert(pc == 0x202);
+  run(1);
+  assert(V[2] == 0x23);
+
+  // Waiting on the delay timer gives the same result as running the loop
+  initialize();
+  const unsigned char wait[] = { 0xF3, 0x07, 0x33, 0x00, 0x12, 0x00 };
+  copy(wait, wait + 6, memory + 0x200);
+  invalidate(0x200, 6);
+  delay_timer = 5;
+  assert(run(100) == 100);
+  assert(V[3] == 5 && pc == 0x202);
+  pc = 0x204;
+  delay_timer = 4;
+  assert(run(10) == 10);
+  assert(V[3] == 4 && pc == 0x200);
+  delay_timer = 0;           // the loop exits
+  assert(run(2) == 2);
+  assert(V[3] == 0 && pc == 0x206);
+
+  // A jump to itself or an unanswered FX0A doesn't go anywhere
+  initialize();
+  const unsigned char stuck[] = { 0x12, 0x00, 0xF4, 0x0A };
+  copy(stuck, stuck + 4, memory + 0x200);
+  invalidate(0x200, 4);
+  assert(run(50) == 50 && pc == 0x200);
+  assert(waitState() == WAIT_FOREVER);
+  pc = 0x202;
+  sound_timer = 2;
+  assert(run(50) == 50 && pc == 0x202);
+  assert(waitState() == WAIT_TIMER);
+  sound_timer = 0;
+  assert(waitState() == WAIT_KEY);
+  keypad = 1 << 7;
+  assert(waitState() == WAIT_NONE);
+  run(1);
+  assert(V[4] == 7 && pc == 0x204);
+  keypad = 0;
+
+  // and the same straight on the engine, without run()'s shortcuts: FX0A
+  // with no key held stays put however long it's run, then takes the key
+  initialize();
+  copy(stuck, stuck + 4, memory + 0x200);
+  invalidate(0x200, 4);
+  pc = 0x202;
+  assert(runEngine(50) == 50 && pc == 0x202 && V[4] == 0);
+  keypad = 1 << 9;
+  assert(runEngine(1) == 1 && pc == 0x204 && V[4] == 9);
+  keypad = 0;
+  pc = 0x200;
+  assert(runEngine(50) == 50 && pc == 0x200);
+
+  // Roms load at 0x200, replacing any code decoded there
+  initialize();
+  const unsigned char rom[] = { 0x61, 0x22, 0x61, 0x33 };
+  assert(loadGame(rom, 2));
+  uint64_t shortHash = romHash();
+  pc = 0x200;
+  run(1);
+  assert(V[1] == 0x22);
+  assert(loadGame(rom + 2, 2));
+  assert(romHash() != shortHash);
+  pc = 0x200;
+  run(1);
+  assert(V[1] == 0x33);
+
+  // Only XO-CHIP roms can go past 0xFFF
+  vector<unsigned char> big(0x1000 - 0x200 + 1);
+  assert(!loadGame(big.data(), big.size()));
+  setQuirks(QUIRKS_XOCHIP);
+  assert(loadGame(big.data(), big.size()));
+  setQuirks(QUIRKS_DEFAULT);
+
+  // A saved state brings back the registers, memory, screen and random
+  // numbers, and code loaded with it is decoded afresh
+  initialize();
+  V[3] = 0x33; I = 0x345; delay_timer = 7; gfx[0][5][0] = 0xF0F0;
+  memory[0x202] = 0x63; memory[0x203] = 0x44;
+  vector<unsigned char> state;
+  saveState(state);
+  runOpcode(0xC5FF);
+  unsigned char random = V[5];
+  initialize();
+  memory[0x202] = 0x63; memory[0x203] = 0x55;
+  invalidate(0x202, 2);
+  pc = 0x202;
+  run(1);                    // decodes 0x202 as 6355
+  assert(loadState(state));
+  assert(V[3] == 0x33 && I == 0x345 && delay_timer == 7 && pc == 0x200);
+  assert(gfx[0][5][0] == 0xF0F0 && dirtyRows == ~0ULL);
+  runOpcode(0xC5FF);
+  assert(V[5] == random);
+  run(1);
+  assert(V[3] == 0x44);
+
+  // Restoring a snapshot undoes everything since, including code written
+  // over and writes that wrap round the end of memory
+  initialize();
+  memory[0x200] = 0x61; memory[0x201] = 0x22;
+  invalidate(0x200, 2);
+  takeSnapshot();
+  run(1);                    // decodes 0x200 as 6122
+  V[0] = 0x63; V[1] = 0x33; I = 0x200;
+  pc = 0x300;
+  runOpcode(0xF155);         // 0x200 is now 6333
+  I = 0xFFFF;
+  runOpcode(0xF033);         // writes 0xFFFF, 0x0000 and 0x0001
+  assert(restoreSnapshot());
+  assert(pc == 0x200 && V[0] == 0 && V[1] == 0 && I == 0);
+  assert(memory[0] == 0xF0 && memory[1] == 0x90 && memory[0x300] == 0);
+  run(1);
+  assert(V[1] == 0x22);
+
+  // VIP quirks: shifts take VY, logic ops clear VF and FX55 moves I on
+  setQuirks(QUIRKS_VIP);
+  initialize();
+  V[1] = 0x11; V[2] = 0x81;
+  runOpcode(0x8126);
+  assert(V[1] == 0x40 && V[0xF] == 1);
+  runOpcode(0x812E);
+  assert(V[1] == 0x02 && V[0xF] == 1);
+  runOpcode(0x8121);
+  assert(V[1] == 0x83 && V[0xF] == 0);
+  // VY is read before VF is set, so with Y as F it's the old VF shifted
+  V[0xF] = 0x03;
+  runOpcode(0x80F6);
+  assert(V[0] == 0x01 && V[0xF] == 1);
+  V[0xF] = 0x81;
+  runOpcode(0x80FE);
+  assert(V[0] == 0x02 && V[0xF] == 1);
+  I = 0x300;
+  runOpcode(0xF255);
+  assert(I == 0x303);
+
+  // SUPER-CHIP quirks: BXNN, I left alone, and sprites clip at the edges
+  setQuirks(QUIRKS_SCHIP);
+  initialize();
+  V[2] = 4;
+  runOpcode(0xB230);
+  assert(pc == 0x234);
+  I = 0x300;
+  runOpcode(0xF265);
+  assert(I == 0x300);
+  I = 0;
+  V[1] = 62; V[2] = 30;
+  runOpcode(0xD125);
+  assert(gfx[0][30][0] == 0x3 && gfx[0][31][0] == 0x2);
+  assert(gfx[0][0][0] == 0 && V[0xF] == 0);
+
+  // and in high-res mode, VF counts rows that collide or are cut off
+  runOpcode(0x00FF);
+  V[1] = 0; V[2] = 62;
+  runOpcode(0xD125);
+  assert(V[0xF] == 3);
+  runOpcode(0xD125);
+  assert(V[0xF] == 5);
+
+  // F000 is just an unknown opcode, so a skip only steps over its 2 bytes
+  initialize();
+  memory[0x202] = 0xF0; memory[0x203] = 0x00;
+  memory[0x204] = 0x12; memory[0x205] = 0x34;
+  runOpcode(0x3000);
+  assert(pc == 0x204);
+  pc = 0x202;
+  setWarnings(false);
+  run(1);
+  setWarnings(true);
+  assert(I == 0 && pc == 0x204);
+
+  setQuirks(QUIRKS_DEFAULT);
+};
@@ -0,0 +1,185 @@
+#include "stats.h"
+#include <algorithm>    // fill, sort
+#include <vector>
+
+// Opcode classes, in the order they're reported
+enum
+{
+  OP_UNKNOWN, OP_CLS, OP_RET, OP_SCROLL_DOWN, OP_SCROLL_UP, OP_SCROLL_RIGHT,
+  OP_SCROLL_LEFT, OP_EXIT, OP_LORES, OP_HIRES, OP_JUMP, OP_CALL,
+  OP_SKIP_EQUAL, OP_SKIP_NOT_EQUAL, OP_SKIP_EQUAL_REG, OP_STORE_RANGE,
+  OP_FILL_RANGE, OP_LOAD, OP_ADD, OP_MOVE, OP_OR, OP_AND, OP_XOR, OP_ADD_REG,
+  OP_SUB, OP_SHIFT_RIGHT, OP_SUB_REVERSE, OP_SHIFT_LEFT,
+  OP_SKIP_NOT_EQUAL_REG, OP_LOAD_INDEX, OP_JUMP_OFFSET, OP_RANDOM, OP_DRAW,
+  OP_SKIP_KEY, OP_SKIP_NOT_KEY, OP_LOAD_LONG, OP_PLANES, OP_AUDIO,
+  OP_READ_DELAY, OP_WAIT_KEY, OP_SET_DELAY, OP_SET_SOUND, OP_ADD_INDEX,
+  OP_FONT, OP_BIG_FONT, OP_BCD, OP_PITCH, OP_STORE, OP_FILL, OP_SAVE_FLAGS,
+  OP_LOAD_FLAGS, OP_CLASSES
+};
+
+static const char * const classNames[OP_CLASSES] =
+{
+  "????", "00E0", "00EE", "00CN", "00DN", "00FB", "00FC", "00FD", "00FE",
+  "00FF", "1NNN", "2NNN", "3XNN", "4XNN", "5XY0", "5XY2", "5XY3", "6XNN",
+  "7XNN", "8XY0", "8XY1", "8XY2", "8XY3", "8XY4", "8XY5", "8XY6", "8XY7",
+  "8XYE", "9XY0", "ANNN", "BNNN", "CXNN", "DXYN", "EX9E", "EXA1", "F000",
+  "FN01", "F002", "FX07", "FX0A", "FX15", "FX18", "FX1E", "FX29", "FX30",
+  "FX33", "FX3A", "FX55", "FX65", "FX75", "FX85"
+};
+
+static_assert(OP_CLASSES <= sizeof(Stats().opcodes) / sizeof(uint64_t),
+  "too many opcode classes for Stats");
+
+unsigned int opcodeClass(unsigned short opcode){
+  switch (opcode & 0xF000){
+    case 0x0000:
+      switch (opcode){
+        case 0x00E0: return OP_CLS;
+        case 0x00EE: return OP_RET;
+        case 0x00FB: return OP_SCROLL_RIGHT;
+        case 0x00FC: return OP_SCROLL_LEFT;
+        case 0x00FD: return OP_EXIT;
+        case 0x00FE: return OP_LORES;
+        case 0x00FF: return OP_HIRES;
+      }
+      if ((opcode & 0xFFF0) == 0x00C0) return OP_SCROLL_DOWN;
+      if ((opcode & 0xFFF0) == 0x00D0) return OP_SCROLL_UP;
+      return OP_UNKNOWN;
+    case 0x1000: return OP_JUMP;
+    case 0x2000: return OP_CALL;
+    case 0x3000: return OP_SKIP_EQUAL;
+    case 0x4000: return OP_SKIP_NOT_EQUAL;
+    case 0x5000:
+      switch (opcode & 0x000F){
+        case 0x0: return OP_SKIP_EQUAL_REG;
+        case 0x2: return OP_STORE_RANGE;
+        case 0x3: return OP_FILL_RANGE;
+      }
+      return OP_UNKNOWN;
+    case 0x6000: return OP_LOAD;
+    case 0x7000: return OP_ADD;
+    case 0x8000:
+      switch (opcode & 0x000F){
+        case 0x0: return OP_MOVE;
+        case 0x1: return OP_OR;
+        case 0x2: return OP_AND;
+        case 0x3: return OP_XOR;
+        case 0x4: return OP_ADD_REG;
+        case 0x5: return OP_SUB;
+        case 0x6: return OP_SHIFT_RIGHT;
+        case 0x7: return OP_SUB_REVERSE;
+        case 0xE: return OP_SHIFT_LEFT;
+      }
+      return OP_UNKNOWN;
+    case 0x9000:
+      return (opcode & 0x000F) == 0 ? OP_SKIP_NOT_EQUAL_REG : OP_UNKNOWN;
+    case 0xA000: return OP_LOAD_INDEX;
+    case 0xB000: return OP_JUMP_OFFSET;
+    case 0xC000: return OP_RANDOM;
+    case 0xD000: return OP_DRAW;
+    case 0xE000:
+      if ((opcode & 0x00FF) == 0x9E) return OP_SKIP_KEY;
+      if ((opcode & 0x00FF) == 0xA1) return OP_SKIP_NOT_KEY;
+      return OP_UNKNOWN;
+    case 0xF000:
+      switch (opcode & 0x00FF){
+        case 0x00: return opcode == 0xF000 ? OP_LOAD_LONG : OP_UNKNOWN;
+        case 0x01: return OP_PLANES;
+        case 0x02: return opcode == 0xF002 ? OP_AUDIO : OP_UNKNOWN;
+        case 0x07: return OP_READ_DELAY;
+        case 0x0A: return OP_WAIT_KEY;
+        case 0x15: return OP_SET_DELAY;
+        case 0x18: return OP_SET_SOUND;
+        case 0x1E: return OP_ADD_INDEX;
+        case 0x29: return OP_FONT;
+        case 0x30: return OP_BIG_FONT;
+        case 0x33: return OP_BCD;
+        case 0x3A: return OP_PITCH;
+        case 0x55: return OP_STORE;
+        case 0x65: return OP_FILL;
+        case 0x75: return OP_SAVE_FLAGS;
+        case 0x85: return OP_LOAD_FLAGS;
+      }
+      return OP_UNKNOWN;
+  }
+  return OP_UNKNOWN;
+};
+
+const char * opcodeClassName(unsigned int opcodeClass){
+  return opcodeClass < OP_CLASSES ? classNames[opcodeClass] : "????";
+};
+
+void Stats::clear(){
+  std::fill(opcodes, opcodes + 64, 0);
+  std::fill(pcCycles, pcCycles + 4096, 0);
+  waited = 0;
+  draws = 0;
+  pixels = 0;
+  frames = 0;
+  drawnFrames = 0;
+  presentedFrames = 0;
+};
+
+void Stats::add(const Stats & other){
+  for (int i = 0; i < 64; i++)
+    opcodes[i] += other.opcodes[i];
+  for (int i = 0; i < 4096; i++)
+    pcCycles[i] += other.pcCycles[i];
+  waited += other.waited;
+  draws += other.draws;
+  pixels += other.pixels;
+  frames += other.frames;
+  drawnFrames += other.drawnFrames;
+  presentedFrames += other.presentedFrames;
+};
+
+// Share of total as a percentage, or 0 if there's no total
+static double percent(uint64_t count, uint64_t total){
+  return total == 0 ? 0 : 100.0 * count / total;
+};
+
+void Stats::report(FILE * out, unsigned int hotAddresses) const{
+  uint64_t run = 0;
+  for (int i = 0; i < OP_CLASSES; i++)
+    run += opcodes[i];
+  fprintf(out, "instructions run: %llu (plus %llu waited out)\n",
+    (unsigned long long)run, (unsigned long long)waited);
+
+  // Most common first
+  std::vector<unsigned int> order;
+  for (unsigned int i = 0; i < OP_CLASSES; i++){
+    if (opcodes[i] != 0)
+      order.push_back(i);
+  }
+  std::sort(order.begin(), order.end(), [this](unsigned int a, unsigned int b){
+    return opcodes[a] != opcodes[b] ? opcodes[a] > opcodes[b] : a < b;
+  });
+  fprintf(out, "by opcode:\n");
+  for (size_t i = 0; i < order.size(); i++){
+    fprintf(out, "  %s %14llu %6.2f%%\n", classNames[order[i]],
+      (unsigned long long)opcodes[order[i]], percent(opcodes[order[i]], run));
+  }
+
+  std::vector<unsigned int> hot;
+  for (unsigned int a = 0; a < 4096; a++){
+    if (pcCycles[a] != 0)
+      hot.push_back(a);
+  }
+  std::sort(hot.begin(), hot.end(), [this](unsigned int a, unsigned int b){
+    return pcCycles[a] != pcCycles[b] ? pcCycles[a] > pcCycles[b] : a < b;
+  });
+  if (hot.size() > hotAddresses)
+    hot.resize(hotAddresses);
+  fprintf(out, "hottest addresses:\n");
+  for (size_t i = 0; i < hot.size(); i++){
+    fprintf(out, "  0x%03X %13llu %6.2f%%\n", hot[i],
+      (unsigned long long)pcCycles[hot[i]], percent(pcCycles[hot[i]], run));
+  }
+
+  fprintf(out, "draws: %llu, pixels flipped: %llu (%.1f per draw)\n",
+    (unsigned long long)draws, (unsigned long long)pixels,
+    draws == 0 ? 0.0 : (double)pixels / draws);
+  fprintf(out, "frames: %llu emulated, %llu drawn to (%.1f%%), %llu presented\n",
+    (unsigned long long)frames, (unsigned long long)drawnFrames,
+    percent(drawnFrames, frames), (unsigned long long)presentedFrames);
+};
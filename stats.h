@@ -0,0 +1,44 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>     // uint64_t
+#include <stdio.h>      // FILE
+
+// Execution counters for finding out what a rom spends its time on. A machine
+// only counts while a Stats is attached (Chip8::attachStats), and then runs a
+// separately compiled, counting interpreter whatever the engine, so leaving
+// them off costs the normal engines nothing
+struct Stats
+{
+  // instructions run, by class (see opcodeClassName) and by address
+  uint64_t opcodes[64];
+  uint64_t pcCycles[4096];
+  // cycles passed over without being run, because the program was waiting
+  // for the delay timer, a key or nothing (see Chip8::run)
+  uint64_t waited;
+
+  // DXYN calls, and pixels they flipped (on or off)
+  uint64_t draws;
+  uint64_t pixels;
+
+  // emulated frames, frames in which the program drew something, and frames
+  // the front end actually put on screen (filled in by the front end)
+  uint64_t frames;
+  uint64_t drawnFrames;
+  uint64_t presentedFrames;
+
+  Stats() { clear(); }
+  void clear();
+  // Adds another machine's counts to these, e.g. to total up a batch
+  void add(const Stats & other);
+  // Prints every opcode class that ran, the hottest addresses and the
+  // drawing and frame counts
+  void report(FILE * out, unsigned int hotAddresses = 16) const;
+};
+
+// Sorts an opcode into one of the classes counted by Stats: one per
+// instruction, e.g. "8XY4", with "????" for anything unknown
+unsigned int opcodeClass(unsigned short opcode);
+const char * opcodeClassName(unsigned int opcodeClass);
+
+#endif
@@ -0,0 +1,520 @@
+#include "chip8.h"
+#include "handoff.h"
+#include "inputscript.h"
+#include "rewind.h"
+#include "scheduler.h"
+#include <cstdio>         // remove
+#include <cstring>        // strcmp
+#include <memory>         // unique_ptr
+#include <stdint.h>       // uint16_t, uint64_t
+#include <stdio.h>        // printf
+#include <vector>
+using namespace std;
+
+/* The core's tests, run with `make test`. Nothing here touches SDL.
+
+   First the opcode tests (Chip8::selfTest, in selftest.cpp), on every
+   engine. Then the golden tests: small roms, built below, run through the
+   Scheduler for a fixed number of cycles with seed 0, whose final screens
+   have to hash to the values recorded here, on every engine. A change that
+   alters what any of them draws shows up as a failure; if the change is
+   meant to, `--print` gives the new table to paste in.
+
+   Also checks that frames passed through the TripleBuffer keep track of the
+   rows that changed, even when the reader drops some of them, that a
+   headless run ends once the program is stuck, and that the rewind history
+   gives back exactly the states it was given, in a reasonable size, and
+   only under the quirk profile they were saved with. Finally a recorded run
+   is saved, loaded back and replayed, and has to end the same way */
+
+static const char * const engineNames[] = { "interpreter", "cached", "jit" };
+static const Engine engines[] = { ENGINE_INTERPRETER, ENGINE_CACHED,
+  ENGINE_JIT };
+static const char * const profileNames[] = { "QUIRKS_DEFAULT", "QUIRKS_VIP",
+  "QUIRKS_CHIP48", "QUIRKS_SCHIP", "QUIRKS_XOCHIP" };
+
+// Instructions per second the roms are run at, 10 per frame
+static const double hz = 600;
+
+struct Rom
+{
+  const char * name;
+  vector<unsigned short> code;
+  // keys held in each frame, bit i for key i; none after the last
+  vector<uint16_t> keys;
+};
+
+// Hands out a rom's keys one frame at a time
+class ScriptedKeys : public InputSource
+{
+public:
+  explicit ScriptedKeys(const vector<uint16_t> & keys)
+    : keys(keys), frame(0) {}
+
+  uint16_t readKeys(){
+    uint16_t held = frame < keys.size() ? keys[frame] : 0;
+    frame++;
+    return held;
+  }
+
+private:
+  const vector<uint16_t> & keys;
+  size_t frame;
+};
+
+static const Rom roms[] = {
+  // Every font digit, eight to a row
+  { "digits", {
+    0x6000,  // 200: V0 = 0
+    0x6100,  // 202: V1 = 0
+    0x6200,  // 204: V2 = 0
+    0xF029,  // 206: loop: I = font V0
+    0xD125,  // 208: draw
+    0x7001,  // 20A: V0 += 1
+    0x7108,  // 20C: V1 += 8
+    0x4140,  // 20E: skip if V1 != 64
+    0x2220,  // 210: call newline
+    0x3010,  // 212: skip if V0 == 16
+    0x1206,  // 214: jump loop
+    0x1216,  // 216: done: jump done
+    0x0000, 0x0000, 0x0000, 0x0000,
+    0x6100,  // 220: newline: V1 = 0
+    0x7208,  // 222: V2 += 8
+    0x00EE   // 224: return
+  }, {} },
+
+  // The 8XYN family, with each result and VF shown in decimal
+  { "maths", {
+    0x6B00,  // 200: VB = 0
+    0x6C00,  // 202: VC = 0
+    0x63C8,  // 204: V3 = 200
+    0x6464,  // 206: V4 = 100
+    0x8344,  // 208: V3 += V4
+    0x8A30,  // 20A: VA = V3
+    0x2240,  // 20C: call show
+    0x8AF0,  // 20E: VA = VF
+    0x2240,  // 210: call show
+    0x8345,  // 212: V3 -= V4
+    0x8A30,  // 214: VA = V3
+    0x2240,  // 216: call show
+    0x6B00,  // 218: VB = 0
+    0x6C08,  // 21A: VC = 8
+    0x8346,  // 21C: V3 >>= 1 (or V3 = V4 >> 1)
+    0x8A30,  // 21E: VA = V3
+    0x2240,  // 220: call show
+    0x834E,  // 222: V3 <<= 1 (or V3 = V4 << 1)
+    0x8A30,  // 224: VA = V3
+    0x2240,  // 226: call show
+    0x8343,  // 228: V3 ^= V4
+    0x8A30,  // 22A: VA = V3
+    0x2240,  // 22C: call show
+    0x122E,  // 22E: done: jump done
+    0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+    0xA300,  // 240: show: I = 0x300
+    0xFA33,  // 242: BCD of VA
+    0xF265,  // 244: V0-V2 = digits
+    0xF029,  // 246: I = font V0
+    0xDBC5,  // 248: draw at VB, VC
+    0x7B05,  // 24A: VB += 5
+    0xF129,  // 24C: I = font V1
+    0xDBC5,  // 24E: draw
+    0x7B05,  // 250: VB += 5
+    0xF229,  // 252: I = font V2
+    0xDBC5,  // 254: draw
+    0x7B06,  // 256: VB += 6
+    0x00EE   // 258: return
+  }, {} },
+
+  // High-res big digits, then scrolled down, right and back left
+  { "hires", {
+    0x00FF,  // 200: high-res
+    0x6000,  // 202: V0 = 0
+    0x6100,  // 204: V1 = 0
+    0x6200,  // 206: V2 = 0
+    0xF030,  // 208: loop: I = big font V0
+    0xD12A,  // 20A: draw
+    0x7001,  // 20C: V0 += 1
+    0x710C,  // 20E: V1 += 12
+    0x300A,  // 210: skip if V0 == 10
+    0x1208,  // 212: jump loop
+    0x00C4,  // 214: scroll down 4
+    0x00FB,  // 216: scroll right 4
+    0x00FB,  // 218: scroll right 4
+    0x00FC,  // 21A: scroll left 4
+    0x121C   // 21C: done: jump done
+  }, {} },
+
+  // XO-CHIP: the same digit on each plane and on both, then scrolled up
+  { "planes", {
+    0x6008,  // 200: V0 = 8
+    0xF029,  // 202: I = font V0
+    0x6105,  // 204: V1 = 5
+    0x6205,  // 206: V2 = 5
+    0xF101,  // 208: plane 1
+    0xD125,  // 20A: draw
+    0xF201,  // 20C: plane 2
+    0x7103,  // 20E: V1 += 3
+    0xD125,  // 210: draw
+    0xF301,  // 212: both planes
+    0x7103,  // 214: V1 += 3
+    0xD125,  // 216: draw
+    0x00D2,  // 218: scroll up 2
+    0x121A   // 21A: done: jump done
+  }, {} },
+
+  // Random lines at random places, which have to come out the same from
+  // the same seed
+  { "random", {
+    0xA210,  // 200: I = line
+    0xC03F,  // 202: loop: V0 = random & 63
+    0xC11F,  // 204: V1 = random & 31
+    0xD011,  // 206: draw
+    0x1202,  // 208: jump loop
+    0x0000, 0x0000, 0x0000,
+    0xFF00   // 210: line
+  }, {} },
+
+  // A digit every other frame, paced by the delay timer
+  { "timers", {
+    0x6300,  // 200: V3 = 0
+    0x6102,  // 202: loop: V1 = 2
+    0xF115,  // 204: delay = V1
+    0xF007,  // 206: wait: V0 = delay
+    0x3000,  // 208: skip if V0 == 0
+    0x1206,  // 20A: jump wait
+    0xA000,  // 20C: I = font 0
+    0xD305,  // 20E: draw at V3, 0
+    0x7305,  // 210: V3 += 5
+    0x1202   // 212: jump loop
+  }, {} },
+
+  // Each key FX0A reads, drawn as it's read (over and over while a key is
+  // held, as FX0A doesn't wait for it to be let go)
+  { "keys", {
+    0x6100,  // 200: V1 = 0
+    0x6200,  // 202: V2 = 0
+    0xF00A,  // 204: loop: V0 = next key
+    0xF029,  // 206: I = font V0
+    0xD125,  // 208: draw
+    0x7105,  // 20A: V1 += 5
+    0x1204   // 20C: jump loop
+  }, { 0, 0, 1 << 5, 1 << 5, 0, 0, 1 << 0xA, 1 << 0xA, 0, 0, 0, 1 << 3,
+       1 << 3, 1 << 3, 0, 0, 1 << 0xF, 0 } }
+};
+
+struct Golden
+{
+  const char * rom;
+  QuirkProfile quirks;
+  unsigned long long cycles;
+  uint64_t screen;
+};
+
+static const Golden goldens[] = {
+  { "digits", QUIRKS_DEFAULT, 2000, 0xA6539F20102DA515ULL },
+  { "digits", QUIRKS_SCHIP, 2000, 0xA6539F20102DA515ULL },
+  { "maths", QUIRKS_DEFAULT, 2000, 0x493826F5C604C9B0ULL },
+  { "maths", QUIRKS_VIP, 2000, 0x387FEDBEE54BE157ULL },
+  { "maths", QUIRKS_SCHIP, 2000, 0x493826F5C604C9B0ULL },
+  { "hires", QUIRKS_SCHIP, 2000, 0xC7370F62CAC77F02ULL },
+  { "hires", QUIRKS_XOCHIP, 2000, 0xC7370F62CAC77F02ULL },
+  { "planes", QUIRKS_XOCHIP, 2000, 0x2DCBDC9F4B0CC0B2ULL },
+  { "random", QUIRKS_DEFAULT, 2000, 0x54D73568DCB29673ULL },
+  { "random", QUIRKS_VIP, 2000, 0x312C1DF2458113FDULL },
+  { "timers", QUIRKS_DEFAULT, 300, 0x3E07E8CF05C16535ULL },
+  { "keys", QUIRKS_DEFAULT, 300, 0x8417AFA97EA571F8ULL }
+};
+
+static const Rom * findRom(const char * name){
+  for (size_t i = 0; i < sizeof(roms) / sizeof(roms[0]); i++){
+    if (strcmp(roms[i].name, name) == 0)
+      return &roms[i];
+  }
+  return NULL;
+}
+
+static vector<unsigned char> romBytes(const Rom & rom){
+  vector<unsigned char> data;
+  for (size_t i = 0; i < rom.code.size(); i++){
+    data.push_back(rom.code[i] >> 8);
+    data.push_back(rom.code[i] & 0xFF);
+  }
+  return data;
+}
+
+// Runs a rom from seed 0 and returns the hash of its final screen
+static uint64_t runGolden(const Rom & rom, QuirkProfile quirks,
+    unsigned long long cycles, Engine engine){
+  vector<unsigned char> data = romBytes(rom);
+
+  unique_ptr<Chip8> chip8(new Chip8());
+  chip8->setEngine(engine);
+  chip8->setQuirks(quirks);
+  chip8->seed(0);
+  chip8->initialize();
+  chip8->loadGame(data.data(), data.size());
+
+  ScriptedKeys input(rom.keys);
+  Scheduler scheduler(hz, cycles);
+  while (scheduler.runFrame(*chip8, input))
+    ;
+  return chip8->screenHash();
+}
+
+// Returns the number of goldens that failed on some engine. Printing the
+// table still needs every engine to agree
+static int goldenTests(bool print){
+  int failures = 0;
+  for (size_t g = 0; g < sizeof(goldens) / sizeof(goldens[0]); g++){
+    const Golden & golden = goldens[g];
+    const Rom * rom = findRom(golden.rom);
+    uint64_t screens[3];
+    bool failed = false;
+    for (int e = 0; e < 3; e++){
+      screens[e] = runGolden(*rom, golden.quirks, golden.cycles, engines[e]);
+      uint64_t expected = print ? screens[0] : golden.screen;
+      if (screens[e] != expected){
+        printf("%s (%s) on %s: screen 0x%016llX, expected 0x%016llX\n",
+          golden.rom, profileNames[golden.quirks], engineNames[e],
+          (unsigned long long)screens[e], (unsigned long long)expected);
+        failed = true;
+      }
+    }
+    if (print){
+      printf("  { \"%s\", %s, %llu, 0x%016llXULL },\n", golden.rom,
+        profileNames[golden.quirks], golden.cycles,
+        (unsigned long long)screens[0]);
+    }
+    failures += failed;
+  }
+  return failures;
+}
+
+// A frame with one row changed
+static FrameView rowFrame(const uint64_t (*planes)[128], unsigned int row){
+  FrameView frame;
+  frame.planes[0] = planes[0];
+  frame.planes[1] = planes[1];
+  frame.width = 64;
+  frame.height = 32;
+  frame.dirtyRows = 1ULL << row;
+  frame.sequence = row;
+  return frame;
+}
+
+// Returns false (having said why) if a consumed frame misses rows changed by
+// the frames dropped before it
+static bool handoffTests(){
+  static const uint64_t planes[2][128] = { { 0 } };
+  TripleBuffer buffer;
+  FrameView frame;
+
+  // Rows 1 and 2 are dropped in favour of 3; 4 and 5 are each taken
+  buffer.publish(rowFrame(planes, 0));
+  bool passed = buffer.consume(frame) && frame.dirtyRows == 1;
+  buffer.publish(rowFrame(planes, 1));
+  buffer.publish(rowFrame(planes, 2));
+  buffer.publish(rowFrame(planes, 3));
+  passed = passed && buffer.consume(frame) && frame.sequence == 3 &&
+    (frame.dirtyRows & 0xE) == 0xE;
+  buffer.publish(rowFrame(planes, 4));
+  passed = passed && buffer.consume(frame) && (frame.dirtyRows & 0x10);
+  buffer.publish(rowFrame(planes, 5));
+  passed = passed && buffer.consume(frame) && (frame.dirtyRows & 0x20) &&
+    !buffer.consume(frame);
+  if (!passed)
+    printf("TripleBuffer lost the dirty rows of dropped frames\n");
+  return passed;
+}
+
+// Returns false (having said why) if a headless run doesn't end once the
+// program is stuck in a jump to itself, or ends while the timers still run
+static bool schedulerTests(){
+  // 200: delay = 3, then a jump to itself
+  static const unsigned char rom[] = { 0x60, 0x03, 0xF0, 0x15, 0x12, 0x04 };
+  bool passed = true;
+  for (int e = 0; e < 3; e++){
+    unique_ptr<Chip8> chip8(new Chip8());
+    chip8->setEngine(engines[e]);
+    chip8->initialize();
+    chip8->loadGame(rom, sizeof(rom));
+    NullInput input;
+    Scheduler scheduler(hz, 0);
+    scheduler.stopWhenStuck(true);
+    int frames = 1;
+    while (frames < 100 && scheduler.runFrame(*chip8, input))
+      frames++;
+    if (!scheduler.stuck || frames != 3){
+      printf("A stuck program ran for %i frames on %s, expected 3\n", frames,
+        engineNames[e]);
+      passed = false;
+    }
+  }
+  return passed;
+}
+
+// Runs a frame and records it, keeping its state in states too
+static void rewindFrame(Chip8 & chip8, Scheduler & scheduler, Rewind & rewind,
+    vector<vector<unsigned char> > & states){
+  NullInput input;
+  scheduler.runFrame(chip8, input);
+  rewind.push(chip8);
+  states.push_back(vector<unsigned char>());
+  chip8.saveState(states.back());
+}
+
+// Steps back a frame, and returns false if that isn't the newest state left
+// in states, byte for byte
+static bool rewindStep(Chip8 & chip8, Rewind & rewind,
+    vector<vector<unsigned char> > & states){
+  vector<unsigned char> state;
+  if (!rewind.pop(chip8))
+    return false;
+  chip8.saveState(state);
+  bool same = state == states.back();
+  states.pop_back();
+  return same;
+}
+
+// Returns false (having said why) if stepping back through a Rewind doesn't
+// give back each recorded state exactly, or it keeps the wrong number of
+// frames, or a minute of history takes a megabyte or more, or a save state
+// loads under the wrong quirk profile
+static bool rewindTests(){
+  vector<unsigned char> data = romBytes(*findRom("random"));
+  unique_ptr<Chip8> chip8(new Chip8());
+  chip8->seed(0);
+  chip8->initialize();
+  chip8->loadGame(data.data(), data.size());
+  Scheduler scheduler(hz, 0);
+
+  // 120 frames with a keyframe every 30: 300 frames in, the oldest
+  // keyframes have gone, and stepping back starts from the middle of one
+  Rewind rewind(120, 30);
+  vector<vector<unsigned char> > states;
+  for (int f = 0; f < 300; f++)
+    rewindFrame(*chip8, scheduler, rewind, states);
+  bool passed = rewind.frames() > 90 && rewind.frames() <= 120;
+  for (int f = 0; f < 50 && passed; f++)
+    passed = rewindStep(*chip8, rewind, states);
+
+  // Then carry on from there, past the next keyframe, and step all the way
+  // back until the history runs out
+  for (int f = 0; f < 40; f++)
+    rewindFrame(*chip8, scheduler, rewind, states);
+  size_t kept = rewind.frames();
+  passed = passed && kept > 90 && kept <= 120;
+  while (passed && rewind.frames() > 0)
+    passed = rewindStep(*chip8, rewind, states);
+  passed = passed && !rewind.pop(*chip8) && rewind.bytes() == 0;
+  if (!passed){
+    printf("Rewind didn't give back the frames it recorded\n");
+    return false;
+  }
+
+  // A minute of a program that draws every other frame, paced by the delay
+  // timer like most games
+  data = romBytes(*findRom("timers"));
+  chip8->initialize();
+  chip8->loadGame(data.data(), data.size());
+  Rewind minute;
+  for (int f = 0; f < 60 * frameRate; f++){
+    NullInput input;
+    scheduler.runFrame(*chip8, input);
+    minute.push(*chip8);
+  }
+  if (minute.bytes() >= 1 << 20){
+    printf("A minute of rewind history took %zu bytes\n", minute.bytes());
+    passed = false;
+  }
+
+  // A state saved under one quirk profile won't load under another
+  vector<unsigned char> state;
+  chip8->saveState(state);
+  chip8->setQuirks(QUIRKS_VIP);
+  if (chip8->loadState(state)){
+    printf("A save state loaded under another quirk profile\n");
+    passed = false;
+  }
+  return passed;
+}
+
+// Returns false (having said why) if a run recorded with InputRecorder and
+// read back with InputScript doesn't replay to the same end
+static bool recordingTests(){
+  const Rom & rom = *findRom("keys");
+  vector<unsigned char> data = romBytes(rom);
+  const char * path = "chip8-test-recording.txt";
+  const uint64_t seed = 1234;
+  const double hz = 500;
+
+  // Record the rom's scripted keys, as main.out --record does
+  unique_ptr<Chip8> chip8(new Chip8());
+  chip8->setQuirks(QUIRKS_SCHIP);
+  chip8->seed(seed);
+  chip8->initialize();
+  chip8->loadGame(data.data(), data.size());
+  ScriptedKeys keys(rom.keys);
+  InputRecorder recorder(keys);
+  Scheduler recording(hz, 3000);
+  do
+    recorder.seek(recording.totalCycles);
+  while (recording.runFrame(*chip8, recorder));
+  uint64_t screen = chip8->screenHash();
+  uint64_t machine = chip8->machineHash();
+  bool passed = recorder.save(path, seed, hz, QUIRKS_SCHIP,
+    recording.totalCycles, screen);
+
+  // Then load it and replay it, as main.out --replay does
+  InputScript script;
+  passed = passed && script.load(path);
+  remove(path);
+  passed = passed && script.hasSeed && script.seed == seed &&
+    script.hz == hz && script.hasQuirks && script.quirks == QUIRKS_SCHIP &&
+    script.hasEnd && script.endCycle == recording.totalCycles &&
+    script.endHash == screen;
+  if (passed){
+    chip8.reset(new Chip8());
+    chip8->setQuirks(script.quirks);
+    chip8->seed(script.seed);
+    chip8->initialize();
+    chip8->loadGame(data.data(), data.size());
+    Scheduler replay(script.hz, script.endCycle);
+    do
+      script.seek(replay.totalCycles);
+    while (replay.runFrame(*chip8, script));
+    passed = replay.totalCycles == script.endCycle &&
+      chip8->screenHash() == script.endHash &&
+      chip8->machineHash() == machine;
+  }
+  if (!passed)
+    printf("A recorded run didn't replay to the same end\n");
+  return passed;
+}
+
+int main(int argc, char **argv)
+{
+  bool print = argc > 1 && strcmp(argv[1], "--print") == 0;
+  if (argc > 1 && !print){
+    printf("Usage: ./chip8-test [--print]\n");
+    printf("  --print         print the golden table for the current core\n");
+    return 1;
+  }
+
+  if (!print){
+    unique_ptr<Chip8> chip8(new Chip8());
+    chip8->selfTest();
+    if (!handoffTests() || !schedulerTests() || !rewindTests() ||
+        !recordingTests())
+      return 1;
+  }
+
+  int failures = goldenTests(print);
+  if (failures != 0){
+    printf("%i golden test(s) failed\n", failures);
+    return 1;
+  }
+  if (!print)
+    printf("Golden tests passed\n");
+  return 0;
+}